@@ -16,41 +16,76 @@
 static const char* pszBase58 = "123456789ABCDEFGHJKLMNPQRSTUVWXYZabcdefghijkmnopqrstuvwxyz";
 
 
-inline string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
+// Digit values by character, -1 for anything not in pszBase58
+static const signed char pBase58Map[256] =
 {
-    CAutoBN_CTX pctx;
-    CBigNum bn58 = 58;
-    CBigNum bn0 = 0;
-
-    // Convert big endian data to little endian
-    // Extra zero at the end make sure bignum will interpret as a positive number
-    vector<unsigned char> vchTmp(pend-pbegin+1, 0);
-    reverse_copy(pbegin, pend, vchTmp.begin());
-
-    // Convert little endian data to bignum
-    CBigNum bn;
-    bn.setvch(vchTmp);
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1, 0, 1, 2, 3, 4, 5, 6, 7, 8,-1,-1,-1,-1,-1,-1,
+    -1, 9,10,11,12,13,14,15,16,-1,17,18,19,20,21,-1,
+    22,23,24,25,26,27,28,29,30,31,32,-1,-1,-1,-1,-1,
+    -1,33,34,35,36,37,38,39,40,41,42,43,-1,44,45,46,
+    47,48,49,50,51,52,53,54,55,56,57,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+};
+
+
+// The conversions work digit by digit on byte arrays, multiplying each new
+// input digit into the output so far.  That's quadratic, but with addresses
+// only 25 bytes long it's far cheaper than allocating BIGNUMs.  Anything up
+// to 128 digits converts in a buffer on the stack.
 
-    // Convert bignum to string
-    string str;
-    str.reserve((pend - pbegin) * 138 / 100 + 1);
-    CBigNum dv;
-    CBigNum rem;
-    while (bn > bn0)
+inline string EncodeBase58(const unsigned char* pbegin, const unsigned char* pend)
+{
+    // Leading zeroes encoded as base58 zeros
+    int nZeros = 0;
+    while (pbegin < pend && *pbegin == 0)
     {
-        if (!BN_div(&dv, &rem, &bn, &bn58, pctx))
-            throw bignum_error("EncodeBase58 : BN_div failed");
-        bn = dv;
-        unsigned int c = rem.getulong();
-        str += pszBase58[c];
+        pbegin++;
+        nZeros++;
     }
 
-    // Leading zeroes encoded as base58 zeros
-    for (const unsigned char* p = pbegin; p < pend && *p == 0; p++)
-        str += pszBase58[0];
+    // Base58 digits, little endian.  log(256)/log(58) is just under 1.38.
+    unsigned int nMax = (pend - pbegin) * 138 / 100 + 1;
+    unsigned char pchBuf[128];
+    vector<unsigned char> vchBuf;
+    unsigned char* pdigits = pchBuf;
+    if (nMax > sizeof(pchBuf))
+    {
+        vchBuf.resize(nMax);
+        pdigits = &vchBuf[0];
+    }
+    unsigned int nDigits = 0;
+    for (const unsigned char* p = pbegin; p < pend; p++)
+    {
+        unsigned int nCarry = *p;
+        for (unsigned int i = 0; i < nDigits; i++)
+        {
+            nCarry += (unsigned int)pdigits[i] << 8;
+            pdigits[i] = nCarry % 58;
+            nCarry /= 58;
+        }
+        while (nCarry > 0)
+        {
+            pdigits[nDigits++] = nCarry % 58;
+            nCarry /= 58;
+        }
+    }
 
-    // Convert little endian string to big endian
-    reverse(str.begin(), str.end());
+    // Convert little endian digits to big endian string
+    string str;
+    str.reserve(nZeros + nDigits);
+    str.assign(nZeros, pszBase58[0]);
+    for (unsigned int i = nDigits; i > 0; i--)
+        str += pszBase58[pdigits[i-1]];
     return str;
 }
 
@@ -61,19 +96,33 @@ inline string EncodeBase58(const vector<unsigned char>& vch)
 
 inline bool DecodeBase58(const char* psz, vector<unsigned char>& vchRet)
 {
-    CAutoBN_CTX pctx;
     vchRet.clear();
-    CBigNum bn58 = 58;
-    CBigNum bn = 0;
-    CBigNum bnChar;
     while (isspace(*psz))
         psz++;
 
-    // Convert big endian string to bignum
+    // Leading zeros restored from leading base58 zeros
+    int nZeros = 0;
+    while (*psz == pszBase58[0])
+    {
+        psz++;
+        nZeros++;
+    }
+
+    // Value bytes, little endian.  log(58)/log(256) is just under 0.733.
+    unsigned int nMax = strlen(psz) * 733 / 1000 + 1;
+    unsigned char pchBuf[128];
+    vector<unsigned char> vchBuf;
+    unsigned char* pbytes = pchBuf;
+    if (nMax > sizeof(pchBuf))
+    {
+        vchBuf.resize(nMax);
+        pbytes = &vchBuf[0];
+    }
+    unsigned int nBytes = 0;
     for (const char* p = psz; *p; p++)
     {
-        const char* p1 = strchr(pszBase58, *p);
-        if (p1 == NULL)
+        int nDigit = pBase58Map[(unsigned char)*p];
+        if (nDigit < 0)
         {
             while (isspace(*p))
                 p++;
@@ -81,27 +130,23 @@ inline bool DecodeBase58(const char* psz, vector<unsigned char>& vchRet)
                 return false;
             break;
         }
-        bnChar.setulong(p1 - pszBase58);
-        if (!BN_mul(&bn, &bn, &bn58, pctx))
-            throw bignum_error("DecodeBase58 : BN_mul failed");
-        bn += bnChar;
+        unsigned int nCarry = nDigit;
+        for (unsigned int i = 0; i < nBytes; i++)
+        {
+            nCarry += (unsigned int)pbytes[i] * 58;
+            pbytes[i] = nCarry & 0xff;
+            nCarry >>= 8;
+        }
+        while (nCarry > 0)
+        {
+            pbytes[nBytes++] = nCarry & 0xff;
+            nCarry >>= 8;
+        }
     }
 
-    // Get bignum as little endian data
-    vector<unsigned char> vchTmp = bn.getvch();
-
-    // Trim off sign byte if present
-    if (vchTmp.size() >= 2 && vchTmp.end()[-1] == 0 && vchTmp.end()[-2] >= 0x80)
-        vchTmp.erase(vchTmp.end()-1);
-
-    // Restore leading zeros
-    int nLeadingZeros = 0;
-    for (const char* p = psz; *p == pszBase58[0]; p++)
-        nLeadingZeros++;
-    vchRet.assign(nLeadingZeros + vchTmp.size(), 0);
-
     // Convert little endian data to big endian
-    reverse_copy(vchTmp.begin(), vchTmp.end(), vchRet.end() - vchTmp.size());
+    vchRet.assign(nZeros + nBytes, 0);
+    reverse_copy(pbytes, pbytes + nBytes, vchRet.begin() + nZeros);
     return true;
 }
 
@@ -156,31 +201,64 @@ static const unsigned char ADDRESSVERSION = 0;
 
 inline string Hash160ToAddress(uint160 hash160)
 {
-    // add 1-byte version number to the front
-    vector<unsigned char> vch(1, ADDRESSVERSION);
-    vch.insert(vch.end(), UBEGIN(hash160), UEND(hash160));
-    return EncodeBase58Check(vch);
+    // 1-byte version number, hash160 and 4-byte hash check, always 25 bytes
+    unsigned char pch[25];
+    pch[0] = ADDRESSVERSION;
+    memcpy(&pch[1], &hash160, sizeof(hash160));
+    uint256 hash = Hash(&pch[0], &pch[21]);
+    memcpy(&pch[21], &hash, 4);
+    return EncodeBase58(&pch[0], &pch[25]);
 }
 
-inline bool AddressToHash160(const char* psz, uint160& hash160Ret)
+inline bool AddressToHash160(const char* psz, uint160& hash160Ret, vector<unsigned char>& vchTmp)
 {
-    vector<unsigned char> vch;
-    if (!DecodeBase58Check(psz, vch))
+    if (!DecodeBase58Check(psz, vchTmp))
         return false;
-    if (vch.empty())
+    if (vchTmp.empty())
         return false;
-    unsigned char nVersion = vch[0];
-    if (vch.size() != sizeof(hash160Ret) + 1)
+    unsigned char nVersion = vchTmp[0];
+    if (vchTmp.size() != sizeof(hash160Ret) + 1)
         return false;
-    memcpy(&hash160Ret, &vch[1], sizeof(hash160Ret));
+    memcpy(&hash160Ret, &vchTmp[1], sizeof(hash160Ret));
     return (nVersion <= ADDRESSVERSION);
 }
 
+inline bool AddressToHash160(const char* psz, uint160& hash160Ret)
+{
+    vector<unsigned char> vch;
+    return AddressToHash160(psz, hash160Ret, vch);
+}
+
 inline bool AddressToHash160(const string& str, uint160& hash160Ret)
 {
     return AddressToHash160(str.c_str(), hash160Ret);
 }
 
+// Batch versions for converting a whole address book.  The decodes share
+// one scratch vector, so after the first there's no allocation per address.
+inline void Hash160ToAddress(const vector<uint160>& vHash160, vector<string>& vstrRet)
+{
+    vstrRet.resize(vHash160.size());
+    for (unsigned int i = 0; i < vHash160.size(); i++)
+        vstrRet[i] = Hash160ToAddress(vHash160[i]);
+}
+
+inline int AddressToHash160(const vector<string>& vstrAddress, vector<uint160>& vHash160Ret, vector<bool>& vfValidRet)
+{
+    vector<unsigned char> vchTmp;
+    vchTmp.reserve(32);
+    vHash160Ret.assign(vstrAddress.size(), uint160(0));
+    vfValidRet.assign(vstrAddress.size(), false);
+    int nValid = 0;
+    for (unsigned int i = 0; i < vstrAddress.size(); i++)
+    {
+        vfValidRet[i] = AddressToHash160(vstrAddress[i].c_str(), vHash160Ret[i], vchTmp);
+        if (vfValidRet[i])
+            nValid++;
+    }
+    return nValid;
+}
+
 inline bool IsValidBitcoinAddress(const char* psz)
 {
     uint160 hash160;
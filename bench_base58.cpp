@@ -0,0 +1,266 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Address conversion benchmark.  Checks the base58.h codec against the old
+// BIGNUM one on random and edge case input, then times both encoding and
+// decoding a batch of addresses:
+//
+//   bench_base58 [addresses]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <ctype.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <openssl/bn.h>
+#include <openssl/ripemd.h>
+#include "sha.h"
+using namespace std;
+
+// Just enough of uint256.h and util.h for base58.h
+class uint256
+{
+public:
+    unsigned char pn[32];
+};
+
+class uint160
+{
+public:
+    unsigned char pn[20];
+    uint160(int n=0) { memset(pn, 0, sizeof(pn)); pn[0] = n; }
+    bool operator==(const uint160& b) const { return memcmp(pn, b.pn, sizeof(pn)) == 0; }
+};
+
+template<typename T1>
+inline uint256 Hash(const T1 pbegin, const T1 pend)
+{
+    uint256 hash1;
+    CryptoPP::SHA256_Hash((unsigned char*)&hash1, (unsigned char*)&pbegin[0], (pend - pbegin) * sizeof(pbegin[0]));
+    uint256 hash2;
+    CryptoPP::SHA256_Hash((unsigned char*)&hash2, (unsigned char*)&hash1, sizeof(hash1));
+    return hash2;
+}
+
+inline uint160 Hash160(const vector<unsigned char>& vch)
+{
+    uint256 hash1;
+    CryptoPP::SHA256_Hash((unsigned char*)&hash1, &vch[0], vch.size());
+    uint160 hash2;
+    RIPEMD160((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+    return hash2;
+}
+
+#include "base58.h"
+
+
+
+// The old codec, same BN_div or BN_mul per digit on raw BIGNUMs
+string EncodeBase58Old(const unsigned char* pbegin, const unsigned char* pend)
+{
+    BN_CTX* pctx = BN_CTX_new();
+    BIGNUM* bn58 = BN_new();
+    BIGNUM* bn = BN_new();
+    BIGNUM* dv = BN_new();
+    BIGNUM* rem = BN_new();
+    BN_set_word(bn58, 58);
+    BN_bin2bn(pbegin, pend - pbegin, bn);
+
+    string str;
+    while (!BN_is_zero(bn))
+    {
+        BN_div(dv, rem, bn, bn58, pctx);
+        BN_copy(bn, dv);
+        str += pszBase58[BN_get_word(rem)];
+    }
+    for (const unsigned char* p = pbegin; p < pend && *p == 0; p++)
+        str += pszBase58[0];
+    reverse(str.begin(), str.end());
+
+    BN_free(rem);
+    BN_free(dv);
+    BN_free(bn);
+    BN_free(bn58);
+    BN_CTX_free(pctx);
+    return str;
+}
+
+bool DecodeBase58Old(const char* psz, vector<unsigned char>& vchRet)
+{
+    vchRet.clear();
+    while (isspace(*psz))
+        psz++;
+
+    BN_CTX* pctx = BN_CTX_new();
+    BIGNUM* bn58 = BN_new();
+    BIGNUM* bn = BN_new();
+    BIGNUM* bnChar = BN_new();
+    BN_set_word(bn58, 58);
+    BN_zero(bn);
+    bool fRet = true;
+    for (const char* p = psz; *p; p++)
+    {
+        const char* p1 = strchr(pszBase58, *p);
+        if (p1 == NULL)
+        {
+            while (isspace(*p))
+                p++;
+            if (*p != '\0')
+                fRet = false;
+            break;
+        }
+        BN_set_word(bnChar, p1 - pszBase58);
+        BN_mul(bn, bn, bn58, pctx);
+        BN_add(bn, bn, bnChar);
+    }
+
+    if (fRet)
+    {
+        vector<unsigned char> vchTmp(BN_num_bytes(bn));
+        BN_bn2bin(bn, vchTmp.empty() ? NULL : &vchTmp[0]);
+        int nLeadingZeros = 0;
+        for (const char* p = psz; *p == pszBase58[0]; p++)
+            nLeadingZeros++;
+        vchRet.assign(nLeadingZeros, 0);
+        vchRet.insert(vchRet.end(), vchTmp.begin(), vchTmp.end());
+    }
+
+    BN_free(bnChar);
+    BN_free(bn);
+    BN_free(bn58);
+    BN_CTX_free(pctx);
+    return fRet;
+}
+
+string Hash160ToAddressOld(uint160 hash160)
+{
+    vector<unsigned char> vch(1, ADDRESSVERSION);
+    vch.insert(vch.end(), (unsigned char*)&hash160, (unsigned char*)&hash160 + sizeof(hash160));
+    uint256 hash = Hash(vch.begin(), vch.end());
+    vch.insert(vch.end(), (unsigned char*)&hash, (unsigned char*)&hash + 4);
+    return EncodeBase58Old(&vch[0], &vch[0] + vch.size());
+}
+
+bool AddressToHash160Old(const string& str, uint160& hash160Ret)
+{
+    vector<unsigned char> vch;
+    if (!DecodeBase58Old(str.c_str(), vch) || vch.size() != sizeof(hash160Ret) + 5)
+        return false;
+    uint256 hash = Hash(vch.begin(), vch.end()-4);
+    if (memcmp(&hash, &vch.end()[-4], 4) != 0)
+        return false;
+    memcpy(&hash160Ret, &vch[1], sizeof(hash160Ret));
+    return (vch[0] <= ADDRESSVERSION);
+}
+
+
+
+bool CheckCodec()
+{
+    // Random lengths with runs of leading zeros
+    for (int i = 0; i < 10000; i++)
+    {
+        vector<unsigned char> vch(rand() % 80);
+        int nZeros = rand() % 4;
+        for (int j = 0; j < vch.size(); j++)
+            vch[j] = (j < nZeros ? 0 : rand());
+        const unsigned char* pbegin = (vch.empty() ? NULL : &vch[0]);
+        string str = EncodeBase58(pbegin, pbegin + vch.size());
+        if (str != EncodeBase58Old(pbegin, pbegin + vch.size()))
+            return false;
+        vector<unsigned char> vchNew, vchOld;
+        if (!DecodeBase58(str, vchNew) || !DecodeBase58Old(str.c_str(), vchOld) || vchNew != vchOld || vchNew != vch)
+            return false;
+    }
+
+    // Whitespace and bad characters have to be treated the same way
+    const char* pszCases[] = { "", " ", "1", "111", " 1z ", "2g\n", "3mJr7AoUXx2Wqd", "0", "O1", "l", "I", "1 1",
+                               "  1111abc  \t", "zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz", "abc\xff", "\x80" };
+    for (int i = 0; i < sizeof(pszCases)/sizeof(pszCases[0]); i++)
+    {
+        vector<unsigned char> vchNew, vchOld;
+        bool fNew = DecodeBase58(pszCases[i], vchNew);
+        bool fOld = DecodeBase58Old(pszCases[i], vchOld);
+        if (fNew != fOld || vchNew != vchOld)
+            return false;
+    }
+    return true;
+}
+
+double Seconds(clock_t nStart)
+{
+    return (double)(clock() - nStart) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char* argv[])
+{
+    int nCount = (argc >= 2 ? atoi(argv[1]) : 20000);
+    if (nCount <= 0)
+        nCount = 20000;
+
+    if (!CheckCodec())
+    {
+        printf("codec check failed, base58.h doesn't match the BIGNUM version\n");
+        return 1;
+    }
+
+    vector<uint160> vHash160(nCount);
+    for (int i = 0; i < nCount; i++)
+        for (int j = 0; j < sizeof(vHash160[i].pn); j++)
+            vHash160[i].pn[j] = rand();
+
+    // Encode
+    clock_t nStart = clock();
+    vector<string> vstrOld(nCount);
+    for (int i = 0; i < nCount; i++)
+        vstrOld[i] = Hash160ToAddressOld(vHash160[i]);
+    double dOld = Seconds(nStart);
+
+    nStart = clock();
+    vector<string> vstrNew;
+    Hash160ToAddress(vHash160, vstrNew);
+    double dNew = Seconds(nStart);
+    if (vstrNew != vstrOld)
+    {
+        printf("Hash160ToAddress doesn't match the BIGNUM version\n");
+        return 1;
+    }
+    printf("Hash160ToAddress x%d: BIGNUM %.3fs, base58.h %.3fs\n", nCount, dOld, dNew);
+
+    // Decode
+    nStart = clock();
+    vector<uint160> vHash160Old(nCount);
+    for (int i = 0; i < nCount; i++)
+        if (!AddressToHash160Old(vstrOld[i], vHash160Old[i]))
+            return 1;
+    dOld = Seconds(nStart);
+
+    nStart = clock();
+    for (int i = 0; i < nCount; i++)
+    {
+        uint160 hash160;
+        if (!AddressToHash160(vstrOld[i], hash160) || !(hash160 == vHash160[i]))
+            return 1;
+    }
+    dNew = Seconds(nStart);
+
+    nStart = clock();
+    vector<uint160> vHash160New;
+    vector<bool> vfValid;
+    int nValid = AddressToHash160(vstrOld, vHash160New, vfValid);
+    double dBatch = Seconds(nStart);
+    if (nValid != nCount || vHash160New != vHash160 || vHash160Old != vHash160)
+    {
+        printf("AddressToHash160 doesn't match the BIGNUM version\n");
+        return 1;
+    }
+    printf("AddressToHash160 x%d: BIGNUM %.3fs, base58.h %.3fs, batch %.3fs\n", nCount, dOld, dNew, dBatch);
+    return 0;
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Header hashing benchmark.  Runs the same kernels as BitcoinMiner on the
+// genesis block header for a few seconds and prints the hash rate of one
+// thread, so kernel changes can be compared on the same machine:
+//
+//   bench_mining [seconds]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include "sha.h"
+
+using CryptoPP::word32;
+using CryptoPP::ByteReverse;
+
+static const unsigned char pchGenesisMerkleRoot[32] =
+{
+    0x3b, 0xa3, 0xed, 0xfd, 0x7a, 0x7b, 0x12, 0xb2, 0x7a, 0xc7, 0x2c, 0x3e, 0x67, 0x76, 0x8f, 0x61,
+    0x7f, 0xc8, 0x1b, 0xc3, 0x88, 0x8a, 0x51, 0x32, 0x3a, 0x9f, 0xb8, 0xaa, 0x4b, 0x1e, 0x5e, 0x4a,
+};
+static const unsigned int nGenesisNonce = 2083236893;
+
+// Midstate of the genesis header's first 64 bytes and its padded second
+// chunk, in SHA-256 word order like BitcoinMiner's pdata
+void PrepareHeader(word32* pmidstate, word32* pdata)
+{
+    int nVersion = 1;
+    unsigned int nTime = 1231006505;
+    unsigned int nBits = 0x1d00ffff;
+
+    unsigned char pchHeader[128];
+    memset(pchHeader, 0, sizeof(pchHeader));
+    memcpy(pchHeader, &nVersion, 4);
+    memcpy(pchHeader + 36, pchGenesisMerkleRoot, 32);
+    memcpy(pchHeader + 68, &nTime, 4);
+    memcpy(pchHeader + 72, &nBits, 4);
+    pchHeader[80] = 0x80;
+    pchHeader[126] = (80 * 8) >> 8;
+    pchHeader[127] = (80 * 8) & 0xff;
+
+    word32 pwords[32];
+    for (int i = 0; i < 32; i++)
+        pwords[i] = ((word32)pchHeader[4*i] << 24) | ((word32)pchHeader[4*i+1] << 16) | ((word32)pchHeader[4*i+2] << 8) | pchHeader[4*i+3];
+    CryptoPP::SHA256::InitState(pmidstate);
+    CryptoPP::SHA256::Transform(pmidstate, pwords);
+    memcpy(pdata, pwords + 16, 64);
+}
+
+// The genesis nonce has to give a hash with its top 32 bits zero in every lane
+bool CheckKernel(const word32* pmidstate, const word32* pdata)
+{
+    const unsigned int nLanes = CryptoPP::SHA256_Lanes();
+    word32 pnonce[8];
+    word32 phash[8 * 8];
+    for (unsigned int i = 0; i < nLanes; i++)
+        pnonce[i] = ByteReverse((word32)nGenesisNonce);
+    CryptoPP::SHA256_DoubleHashMidstateNonces(phash, pmidstate, pdata, pnonce);
+    for (unsigned int i = 0; i < nLanes; i++)
+        if (phash[8*i + 7] != 0)
+            return false;
+
+    word32 pdata2[16];
+    memcpy(pdata2, pdata, sizeof(pdata2));
+    pdata2[3] = ByteReverse((word32)nGenesisNonce);
+    CryptoPP::SHA256_DoubleHashMidstate(phash, pmidstate, pdata2);
+    return phash[7] == 0;
+}
+
+double Seconds(clock_t nStart)
+{
+    return (double)(clock() - nStart) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char* argv[])
+{
+    double dSeconds = (argc >= 2 ? atof(argv[1]) : 10.0);
+    if (dSeconds <= 0)
+        dSeconds = 10.0;
+
+    word32 pmidstate[8];
+    word32 pdata[16];
+    PrepareHeader(pmidstate, pdata);
+    if (!CheckKernel(pmidstate, pdata))
+    {
+        printf("kernel check failed, genesis nonce doesn't hash below target\n");
+        return 1;
+    }
+
+    // Same loop as BitcoinMiner, clock only checked every 0x40000 nonces
+    const unsigned int nLanes = CryptoPP::SHA256_Lanes();
+    word32 pnonce[8];
+    word32 phash[8 * 8];
+    unsigned int nNonce = 0;
+    double dHashes = 0;
+    unsigned int nFound = 0;
+    clock_t nStart = clock();
+    double dElapsed;
+    do
+    {
+        for (unsigned int n = 0; n < 0x40000; n += nLanes, nNonce += nLanes)
+        {
+            for (unsigned int i = 0; i < nLanes; i++)
+                pnonce[i] = ByteReverse((word32)(nNonce + i));
+            CryptoPP::SHA256_DoubleHashMidstateNonces(phash, pmidstate, pdata, pnonce);
+            for (unsigned int i = 0; i < nLanes; i++)
+                if (phash[8*i + 7] == 0)
+                    nFound++;
+        }
+        dHashes += 0x40000;
+    }
+    while ((dElapsed = Seconds(nStart)) < dSeconds);
+    printf("SHA-256 %s, %u lanes: %.3f Mhash/s (%.0f hashes in %.2fs, %u shares)\n",
+           CryptoPP::SHA256_Implementation(), nLanes, dHashes / dElapsed / 1e6, dHashes, dElapsed, nFound);
+
+    // The one nonce at a time midstate hash for comparison
+    dHashes = 0;
+    nStart = clock();
+    do
+    {
+        for (unsigned int n = 0; n < 0x40000; n++, nNonce++)
+        {
+            pdata[3] = ByteReverse((word32)nNonce);
+            CryptoPP::SHA256_DoubleHashMidstate(phash, pmidstate, pdata);
+            if (phash[7] == 0)
+                nFound++;
+        }
+        dHashes += 0x40000;
+    }
+    while ((dElapsed = Seconds(nStart)) < dSeconds);
+    printf("one nonce at a time: %.3f Mhash/s\n", dHashes / dElapsed / 1e6);
+    return 0;
+}
@@ -0,0 +1,320 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Stand-in miner process for the local work server, see workserver.h for the
+// protocol.  Only needs winsock and sha.cpp, run one per core or NUMA node:
+//
+//   bitcoinworker [port]
+//
+
+#include <winsock2.h>
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "sha.h"
+using namespace std;
+
+using CryptoPP::word32;
+using CryptoPP::ByteReverse;
+
+static const int DEFAULT_WORKSERVER_PORT = 8334;
+static const unsigned int MAX_WORK_MESSAGE = 0x100000;
+
+
+
+
+struct CWork
+{
+    unsigned int nJob;
+    int nVersion;
+    unsigned char hashPrevBlock[32];
+    unsigned int nTime;
+    unsigned int nBits;
+    unsigned char hashTarget[32];
+    vector<unsigned char> vchCoinbase1;
+    vector<unsigned char> vchCoinbase2;
+    vector<unsigned char> vchMerkleBranch;
+};
+
+// Reads fields in the node's serialization format, little-endian with
+// compact sizes in front of vectors
+class CReader
+{
+public:
+    const unsigned char* p;
+    const unsigned char* pend;
+
+    CReader(const vector<unsigned char>& vch) { p = vch.empty() ? NULL : &vch[0]; pend = p + vch.size(); }
+
+    bool Read(void* pout, unsigned int n)
+    {
+        if ((unsigned int)(pend - p) < n)
+            return false;
+        memcpy(pout, p, n);
+        p += n;
+        return true;
+    }
+
+    bool ReadCompactSize(unsigned int& n)
+    {
+        unsigned char chSize;
+        if (!Read(&chSize, 1))
+            return false;
+        n = chSize;
+        if (chSize == 253)
+        {
+            unsigned short nShort;
+            if (!Read(&nShort, 2))
+                return false;
+            n = nShort;
+        }
+        else if (chSize == 254)
+        {
+            if (!Read(&n, 4))
+                return false;
+        }
+        else if (chSize == 255)
+        {
+            return false;
+        }
+        return true;
+    }
+
+    bool ReadBytes(vector<unsigned char>& vch, unsigned int nElemSize)
+    {
+        unsigned int n;
+        if (!ReadCompactSize(n) || n > MAX_WORK_MESSAGE / nElemSize)
+            return false;
+        vch.resize(n * nElemSize);
+        return vch.empty() || Read(&vch[0], vch.size());
+    }
+};
+
+bool SendMessage(SOCKET hSocket, char chCommand, const void* pdata, unsigned int nSize)
+{
+    vector<char> vBuf(5 + nSize);
+    memcpy(&vBuf[0], &nSize, 4);
+    vBuf[4] = chCommand;
+    if (nSize)
+        memcpy(&vBuf[5], pdata, nSize);
+    return send(hSocket, &vBuf[0], vBuf.size(), 0) == (int)vBuf.size();
+}
+
+bool RecvMessage(SOCKET hSocket, char& chCommand, vector<unsigned char>& vchPayload)
+{
+    unsigned char pchHeader[5];
+    for (int n = 0; n < 5;)
+    {
+        int nBytes = recv(hSocket, (char*)pchHeader + n, 5 - n, 0);
+        if (nBytes <= 0)
+            return false;
+        n += nBytes;
+    }
+    unsigned int nSize;
+    memcpy(&nSize, pchHeader, 4);
+    chCommand = pchHeader[4];
+    if (nSize > MAX_WORK_MESSAGE)
+        return false;
+    vchPayload.resize(nSize);
+    for (int n = 0; n < nSize;)
+    {
+        int nBytes = recv(hSocket, (char*)&vchPayload[n], nSize - n, 0);
+        if (nBytes <= 0)
+            return false;
+        n += nBytes;
+    }
+    return true;
+}
+
+bool ParseWork(const vector<unsigned char>& vchPayload, CWork& work)
+{
+    CReader r(vchPayload);
+    return (r.Read(&work.nJob, 4) &&
+            r.Read(&work.nVersion, 4) &&
+            r.Read(work.hashPrevBlock, 32) &&
+            r.Read(&work.nTime, 4) &&
+            r.Read(&work.nBits, 4) &&
+            r.Read(work.hashTarget, 32) &&
+            r.ReadBytes(work.vchCoinbase1, 1) &&
+            r.ReadBytes(work.vchCoinbase2, 1) &&
+            r.ReadBytes(work.vchMerkleBranch, 32));
+}
+
+void DoubleSHA256(const void* pdata, unsigned int nSize, unsigned char* pout)
+{
+    unsigned char hash1[32];
+    CryptoPP::SHA256_Hash(hash1, pdata, nSize);
+    CryptoPP::SHA256_Hash(pout, hash1, 32);
+}
+
+bool HashBelowTarget(const word32* phash, const unsigned char* pchTarget)
+{
+    // Both as 256-bit little-endian numbers, most significant word first
+    for (int i = 7; i >= 0; i--)
+    {
+        word32 nHash = ByteReverse(phash[i]);
+        word32 nTarget;
+        memcpy(&nTarget, pchTarget + 4*i, 4);
+        if (nHash != nTarget)
+            return nHash < nTarget;
+    }
+    return true;
+}
+
+// Header for extranonce2, returned as the midstate of its first 64 bytes
+// and the second chunk already padded, in SHA-256 word order
+void PrepareHeader(const CWork& work, unsigned int nExtraNonce2, word32* pmidstate, word32* pdata)
+{
+    vector<unsigned char> vchCoinbase(work.vchCoinbase1);
+    vchCoinbase.insert(vchCoinbase.end(), (unsigned char*)&nExtraNonce2, (unsigned char*)&nExtraNonce2 + 4);
+    vchCoinbase.insert(vchCoinbase.end(), work.vchCoinbase2.begin(), work.vchCoinbase2.end());
+
+    unsigned char pchPair[64];
+    DoubleSHA256(&vchCoinbase[0], vchCoinbase.size(), pchPair);
+    for (unsigned int i = 0; i < work.vchMerkleBranch.size(); i += 32)
+    {
+        memcpy(pchPair + 32, &work.vchMerkleBranch[i], 32);
+        CryptoPP::SHA256_DoubleHash64(pchPair, pchPair, 1);
+    }
+
+    unsigned char pchHeader[128];
+    memset(pchHeader, 0, sizeof(pchHeader));
+    memcpy(pchHeader, &work.nVersion, 4);
+    memcpy(pchHeader + 4, work.hashPrevBlock, 32);
+    memcpy(pchHeader + 36, pchPair, 32);
+    memcpy(pchHeader + 68, &work.nTime, 4);
+    memcpy(pchHeader + 72, &work.nBits, 4);
+    pchHeader[80] = 0x80;
+    pchHeader[126] = (80 * 8) >> 8;
+    pchHeader[127] = (80 * 8) & 0xff;
+
+    word32 pwords[32];
+    for (int i = 0; i < 32; i++)
+        pwords[i] = ((word32)pchHeader[4*i] << 24) | ((word32)pchHeader[4*i+1] << 16) | ((word32)pchHeader[4*i+2] << 8) | pchHeader[4*i+3];
+    CryptoPP::SHA256::InitState(pmidstate);
+    CryptoPP::SHA256::Transform(pmidstate, pwords);
+    memcpy(pdata, pwords + 16, 64);
+}
+
+int main(int argc, char* argv[])
+{
+    int nPort = (argc >= 2 ? atoi(argv[1]) : DEFAULT_WORKSERVER_PORT);
+
+    WSADATA wsadata;
+    if (WSAStartup(MAKEWORD(2,2), &wsadata) != NO_ERROR)
+    {
+        printf("WSAStartup failed\n");
+        return 1;
+    }
+    SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr.sin_port = htons(nPort);
+    if (hSocket == INVALID_SOCKET || connect(hSocket, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) == SOCKET_ERROR)
+    {
+        printf("couldn't connect to work server on 127.0.0.1:%d\n", nPort);
+        return 1;
+    }
+    printf("connected to 127.0.0.1:%d, SHA-256 %s\n", nPort, CryptoPP::SHA256_Implementation());
+
+    const unsigned int nLanes = CryptoPP::SHA256_Lanes();
+    CWork work;
+    bool fWork = false;
+    unsigned int nExtraNonce2 = 0;
+    unsigned int nNonce = 0;
+    word32 pmidstate[8];
+    word32 pdata[16];
+    word32 pnonce[8];
+    word32 phash[8 * 8];
+    time_t nWorkTime = 0;
+    unsigned int nHashes = 0;
+    time_t nRateTime = time(NULL);
+
+    if (!SendMessage(hSocket, 'g', NULL, 0))
+        return 1;
+    for (;;)
+    {
+        // Take any messages waiting, block only when there is nothing to do
+        for (;;)
+        {
+            fd_set fdsetRecv;
+            FD_ZERO(&fdsetRecv);
+            FD_SET(hSocket, &fdsetRecv);
+            struct timeval timeout = { 0, 0 };
+            if (fWork && select(hSocket + 1, &fdsetRecv, NULL, NULL, &timeout) <= 0)
+                break;
+
+            char chCommand;
+            vector<unsigned char> vchPayload;
+            if (!RecvMessage(hSocket, chCommand, vchPayload))
+            {
+                printf("work server disconnected\n");
+                return 1;
+            }
+            if (chCommand == 'w')
+            {
+                if (!ParseWork(vchPayload, work))
+                {
+                    printf("bad work message\n");
+                    return 1;
+                }
+                fWork = true;
+                nExtraNonce2 = 0;
+                nNonce = 0;
+                nWorkTime = time(NULL);
+                PrepareHeader(work, nExtraNonce2, pmidstate, pdata);
+                printf("job %u\n", work.nJob);
+            }
+            else if (chCommand == 'r' && vchPayload.size() >= 5)
+            {
+                unsigned int nJob;
+                memcpy(&nJob, &vchPayload[0], 4);
+                printf("job %u solution %s\n", nJob, vchPayload[4] ? "accepted" : "rejected");
+            }
+        }
+
+        // Scan a slice of the nonce range
+        for (unsigned int n = 0; n < 0x100000; n += nLanes, nNonce += nLanes)
+        {
+            for (unsigned int i = 0; i < nLanes; i++)
+                pnonce[i] = ByteReverse((word32)(nNonce + i));
+            CryptoPP::SHA256_DoubleHashMidstateNonces(phash, pmidstate, pdata, pnonce);
+            for (unsigned int i = 0; i < nLanes; i++)
+            {
+                if (phash[8*i + 7] == 0 && HashBelowTarget(phash + 8*i, work.hashTarget))
+                {
+                    unsigned int pchSubmit[4] = { work.nJob, nExtraNonce2, work.nTime, nNonce + i };
+                    printf("found job %u nonce %u\n", work.nJob, nNonce + i);
+                    SendMessage(hSocket, 's', pchSubmit, sizeof(pchSubmit));
+                }
+            }
+        }
+        nHashes += 0x100000;
+
+        // Roll extranonce2 when the nonces run out
+        if (nNonce == 0)
+            PrepareHeader(work, ++nExtraNonce2, pmidstate, pdata);
+
+        // Ask for fresh transactions and time every minute
+        if (time(NULL) - nWorkTime > 60)
+        {
+            nWorkTime = time(NULL);
+            SendMessage(hSocket, 'g', NULL, 0);
+        }
+        if (time(NULL) - nRateTime >= 10)
+        {
+            printf("%.0f khash/s\n", nHashes / 1000.0 / (time(NULL) - nRateTime));
+            nHashes = 0;
+            nRateTime = time(NULL);
+        }
+    }
+}
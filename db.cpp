@@ -61,7 +61,7 @@ instance_of_cdbinit;
 // 并以指定的打开模式打开数据库。如果数据库打开成功，则根据事务标志位决定是否启用事务处理模式
 // 。如果启用事务，则调用 TxnBegin 方法开始事务处理；否则，跳过事务处理过程
 // 。如果数据库打开失败，则抛出异常并设置 pdb 为 NULL。
-CDB::CDB(const char* pszFile, const char* pszMode, bool fTxn) : pdb(NULL)
+CDB::CDB(const char* pszFile, const char* pszMode, bool fTxn) : pdb(NULL), fSecure(false)
 {
     int ret;
     if (pszFile == NULL)
@@ -368,7 +368,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
@@ -637,8 +637,8 @@ bool CWalletDB::LoadWallet(vector<unsigned char>& vchDefaultKeyRet)
         loop
         {
             // Read next record
-            CDataStream ssKey;
-            CDataStream ssValue;
+            CDataStream ssKey(SER_DISK, VERSION, fSecure);
+            CDataStream ssValue(SER_DISK, VERSION, fSecure);
             int ret = ReadAtCursor(pcursor, ssKey, ssValue);
             if (ret == DB_NOTFOUND)
                 break;
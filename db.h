@@ -41,6 +41,8 @@ protected:
     // 在比特币节点中，CDB 类使用 DbTxn 结构体来实现数据库事务处理，
     // 以确保在多线程环境下对数据库的读写操作具有原子性和隔离性。
     vector<DbTxn*> vTxn;
+    // Records may hold private keys, clear every buffer they pass through
+    bool fSecure;
 
     explicit CDB(const char* pszFile, const char* pszMode="r+", bool fTxn=false);
     ~CDB() { Close(); }
@@ -58,7 +60,7 @@ protected:
             return false;
 
         // Key
-        CDataStream ssKey(SER_DISK);
+        CDataStream ssKey(SER_DISK, VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         // Dbt" 是 Berkeley DB 数据库中的一个结构体，
@@ -73,16 +75,17 @@ protected:
         Dbt datValue;
         datValue.set_flags(DB_DBT_MALLOC);
         int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
-        memset(datKey.get_data(), 0, datKey.get_size());
         if (datValue.get_data() == NULL)
             return false;
 
         // Unserialize value
-        CDataStream ssValue((char*)datValue.get_data(), (char*)datValue.get_data() + datValue.get_size(), SER_DISK);
+        CDataStream ssValue(SER_DISK, VERSION, fSecure);
+        ssValue.write((char*)datValue.get_data(), datValue.get_size());
         ssValue >> value;
 
         // Clear and free memory
-        memset(datValue.get_data(), 0, datValue.get_size());
+        if (fSecure)
+            memset(datValue.get_data(), 0, datValue.get_size());
         free(datValue.get_data());
         return (ret == 0);
     }
@@ -94,23 +97,19 @@ protected:
             return false;
 
         // Key
-        CDataStream ssKey(SER_DISK);
+        CDataStream ssKey(SER_DISK, VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
-        CDataStream ssValue(SER_DISK);
+        CDataStream ssValue(SER_DISK, VERSION, fSecure);
         ssValue.reserve(10000);
         ssValue << value;
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
         int ret = pdb->put(GetTxn(), &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
-
-        // Clear memory in case it was a private key
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
         return (ret == 0);
     }
 
@@ -121,16 +120,13 @@ protected:
             return false;
 
         // Key
-        CDataStream ssKey(SER_DISK);
+        CDataStream ssKey(SER_DISK, VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
         int ret = pdb->del(GetTxn(), &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
         return (ret == 0 || ret == DB_NOTFOUND);
     }
 
@@ -141,16 +137,13 @@ protected:
             return false;
 
         // Key
-        CDataStream ssKey(SER_DISK);
+        CDataStream ssKey(SER_DISK, VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
         int ret = pdb->exists(GetTxn(), &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
         return (ret == 0);
     }
 
@@ -197,8 +190,11 @@ protected:
         ssValue.write((char*)datValue.get_data(), datValue.get_size());
 
         // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
+        if (fSecure)
+        {
+            memset(datKey.get_data(), 0, datKey.get_size());
+            memset(datValue.get_data(), 0, datValue.get_size());
+        }
         free(datKey.get_data());
         free(datValue.get_data());
         return 0;
@@ -425,7 +421,7 @@ bool LoadAddresses();
 class CWalletDB : public CDB
 {
 public:
-    CWalletDB(const char* pszMode="r+", bool fTxn=false) : CDB("wallet.dat", pszMode, fTxn) { }
+    CWalletDB(const char* pszMode="r+", bool fTxn=false) : CDB("wallet.dat", pszMode, fTxn) { fSecure = true; }
 private:
     CWalletDB(const CWalletDB&);
     void operator=(const CWalletDB&);
@@ -0,0 +1,294 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+
+//
+// Keys are hashes that anyone on the network can pick, so the table hashes
+// them again with a salt chosen at random when the table is first used.
+// Other key types get a SaltedHash overload next to their class.
+//
+inline unsigned int SaltedHash(const uint256& hash, unsigned int nSalt)
+{
+    const unsigned int* pn = (const unsigned int*)&hash;
+    unsigned int h = nSalt;
+    for (int i = 0; i < 8; i++)
+    {
+        h ^= pn[i];
+        h *= 0x5bd1e995;
+        h ^= h >> 15;
+    }
+    return h;
+}
+
+
+
+//
+// Open addressing hash table, a drop-in for std::map where the keys are
+// hashes and nothing needs them in order.  A lookup is one probe of a flat
+// array instead of a walk down a tree comparing 32-byte keys.
+//
+// Each element is allocated on its own like a std::map node, so pointers
+// and references to elements stay valid until they're erased.  Iterators
+// stay valid until the next insert.  Erase leaves a marker in the slot
+// rather than moving anything, so erase(mi++) during a traversal is safe.
+// Traversal goes in slot order, which is arbitrary but the same every time
+// until something is inserted.
+//
+template<typename K, typename T>
+class CHashMap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef pair<const K, T> value_type;
+    typedef unsigned int size_type;
+
+protected:
+    struct CSlot
+    {
+        unsigned int nHash;
+        value_type* pvalue;
+        bool fErased;
+    };
+
+    vector<CSlot> vSlot;
+    unsigned int nSize;
+    unsigned int nErased;
+    unsigned int nSalt;
+
+    unsigned int HashKey(const K& key) const
+    {
+        return SaltedHash(key, nSalt);
+    }
+
+    unsigned int FindSlot(const K& key, unsigned int nHash) const
+    {
+        if (vSlot.empty())
+            return vSlot.size();
+        unsigned int nMask = vSlot.size() - 1;
+        for (unsigned int i = nHash & nMask;; i = (i + 1) & nMask)
+        {
+            const CSlot& slot = vSlot[i];
+            if (slot.pvalue == NULL)
+            {
+                if (!slot.fErased)
+                    return vSlot.size();
+            }
+            else if (slot.nHash == nHash && slot.pvalue->first == key)
+            {
+                return i;
+            }
+        }
+    }
+
+    void Rehash(unsigned int nSlots)
+    {
+        if (vSlot.empty())
+            nSalt = (unsigned int)GetRand(UINT_MAX);
+        vector<CSlot> vOld;
+        vOld.swap(vSlot);
+        CSlot empty;
+        empty.nHash = 0;
+        empty.pvalue = NULL;
+        empty.fErased = false;
+        vSlot.assign(nSlots, empty);
+        nErased = 0;
+        unsigned int nMask = nSlots - 1;
+        for (unsigned int j = 0; j < vOld.size(); j++)
+        {
+            if (vOld[j].pvalue == NULL)
+                continue;
+            unsigned int i = vOld[j].nHash & nMask;
+            while (vSlot[i].pvalue != NULL)
+                i = (i + 1) & nMask;
+            vSlot[i] = vOld[j];
+        }
+    }
+
+    void Erase(unsigned int i)
+    {
+        delete vSlot[i].pvalue;
+        vSlot[i].pvalue = NULL;
+        vSlot[i].fErased = true;
+        nSize--;
+        nErased++;
+    }
+
+public:
+    class iterator;
+    class const_iterator;
+    friend class iterator;
+    friend class const_iterator;
+
+    class iterator
+    {
+    protected:
+        CHashMap* pmap;
+        unsigned int i;
+        friend class CHashMap;
+        friend class const_iterator;
+
+    public:
+        typedef forward_iterator_tag iterator_category;
+        typedef pair<const K, T> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef value_type* pointer;
+        typedef value_type& reference;
+
+        iterator() : pmap(NULL), i(0) { }
+        iterator(CHashMap* pmapIn, unsigned int iIn) : pmap(pmapIn), i(iIn) { }
+        value_type& operator*() const { return *pmap->vSlot[i].pvalue; }
+        value_type* operator->() const { return pmap->vSlot[i].pvalue; }
+        iterator& operator++() { i = pmap->NextSlot(i + 1); return *this; }
+        iterator operator++(int) { iterator tmp = *this; ++*this; return tmp; }
+        friend bool operator==(const iterator& a, const iterator& b) { return a.i == b.i; }
+        friend bool operator!=(const iterator& a, const iterator& b) { return a.i != b.i; }
+    };
+
+    class const_iterator
+    {
+    protected:
+        const CHashMap* pmap;
+        unsigned int i;
+
+    public:
+        typedef forward_iterator_tag iterator_category;
+        typedef pair<const K, T> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator() : pmap(NULL), i(0) { }
+        const_iterator(const CHashMap* pmapIn, unsigned int iIn) : pmap(pmapIn), i(iIn) { }
+        const_iterator(const iterator& it) : pmap(it.pmap), i(it.i) { }
+        const value_type& operator*() const { return *pmap->vSlot[i].pvalue; }
+        const value_type* operator->() const { return pmap->vSlot[i].pvalue; }
+        const_iterator& operator++() { i = pmap->NextSlot(i + 1); return *this; }
+        const_iterator operator++(int) { const_iterator tmp = *this; ++*this; return tmp; }
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a.i == b.i; }
+        friend bool operator!=(const const_iterator& a, const const_iterator& b) { return a.i != b.i; }
+    };
+
+    CHashMap()
+    {
+        nSize = 0;
+        nErased = 0;
+        nSalt = 0;
+    }
+
+    CHashMap(const CHashMap& b)
+    {
+        nSize = 0;
+        nErased = 0;
+        nSalt = 0;
+        *this = b;
+    }
+
+    CHashMap& operator=(const CHashMap& b)
+    {
+        if (this != &b)
+        {
+            clear();
+            for (const_iterator it = b.begin(); it != b.end(); ++it)
+                insert(*it);
+        }
+        return *this;
+    }
+
+    ~CHashMap()
+    {
+        clear();
+    }
+
+    unsigned int NextSlot(unsigned int i) const
+    {
+        while (i < vSlot.size() && vSlot[i].pvalue == NULL)
+            i++;
+        return i;
+    }
+
+    iterator begin()                { return iterator(this, NextSlot(0)); }
+    iterator end()                  { return iterator(this, vSlot.size()); }
+    const_iterator begin() const    { return const_iterator(this, NextSlot(0)); }
+    const_iterator end() const      { return const_iterator(this, vSlot.size()); }
+    unsigned int size() const       { return nSize; }
+    bool empty() const              { return nSize == 0; }
+
+    iterator find(const K& key)
+    {
+        return iterator(this, FindSlot(key, HashKey(key)));
+    }
+
+    const_iterator find(const K& key) const
+    {
+        return const_iterator(this, FindSlot(key, HashKey(key)));
+    }
+
+    unsigned int count(const K& key) const
+    {
+        return (FindSlot(key, HashKey(key)) < vSlot.size() ? 1 : 0);
+    }
+
+    pair<iterator, bool> insert(const value_type& value)
+    {
+        unsigned int nHash = HashKey(value.first);
+        unsigned int i = FindSlot(value.first, nHash);
+        if (i < vSlot.size())
+            return make_pair(iterator(this, i), false);
+
+        // Keep at least a quarter of the slots empty, counting erased ones
+        // as used since probes don't stop at them
+        if ((nSize + nErased + 1) * 4 > vSlot.size() * 3)
+        {
+            unsigned int nSlots = 16;
+            while ((nSize + 1) * 2 > nSlots)
+                nSlots *= 2;
+            Rehash(nSlots);
+            nHash = HashKey(value.first);
+        }
+
+        unsigned int nMask = vSlot.size() - 1;
+        i = nHash & nMask;
+        while (vSlot[i].pvalue != NULL)
+            i = (i + 1) & nMask;
+        if (vSlot[i].fErased)
+            nErased--;
+        vSlot[i].nHash = nHash;
+        vSlot[i].pvalue = new value_type(value);
+        vSlot[i].fErased = false;
+        nSize++;
+        return make_pair(iterator(this, i), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        iterator mi = find(key);
+        if (mi == end())
+            mi = insert(value_type(key, T())).first;
+        return (*mi).second;
+    }
+
+    void erase(iterator it)
+    {
+        Erase(it.i);
+    }
+
+    unsigned int erase(const K& key)
+    {
+        unsigned int i = FindSlot(key, HashKey(key));
+        if (i >= vSlot.size())
+            return 0;
+        Erase(i);
+        return 1;
+    }
+
+    void clear()
+    {
+        for (unsigned int i = 0; i < vSlot.size(); i++)
+            delete vSlot[i].pvalue;
+        vSlot.clear();
+        nSize = 0;
+        nErased = 0;
+    }
+};
@@ -49,6 +49,7 @@
 #include <boost/tuple/tuple_comparison.hpp>
 #include <boost/tuple/tuple_io.hpp>
 #include <boost/array.hpp>
+#include <boost/shared_ptr.hpp>
 #pragma hdrstop
 using namespace std;
 using namespace boost;
@@ -57,14 +58,19 @@ using namespace boost;
 
 #include "serialize.h"
 #include "uint256.h"
+#include "sha.h"
 #include "util.h"
+#include "hashmap.h"
+#include "smallvector.h"
 #include "key.h"
 #include "bignum.h"
 #include "base58.h"
 #include "script.h"
+#include "scriptnum.h"
 #include "db.h"
 #include "net.h"
 #include "irc.h"
+#include "workserver.h"
 #include "main.h"
 #include "market.h"
 #include "uibase.h"
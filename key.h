@@ -195,6 +195,34 @@ public:
         return true;
     }
 
+    // Same, with the nonce set up on the caller's BN_CTX so a run of
+    // signatures doesn't allocate a new one each time
+    bool Sign(uint256 hash, vector<unsigned char>& vchSig, BN_CTX* pctx)
+    {
+        vchSig.clear();
+        BIGNUM* kinv = NULL;
+        BIGNUM* r = NULL;
+        if (!ECDSA_sign_setup(pkey, pctx, &kinv, &r))
+            return false;
+        unsigned char pchSig[10000];
+        unsigned int nSize = 0;
+        bool fOk = ECDSA_sign_ex(0, (unsigned char*)&hash, sizeof(hash), pchSig, &nSize, kinv, r, pkey);
+        BN_clear_free(kinv);
+        BN_clear_free(r);
+        if (!fOk)
+            return false;
+        vchSig.resize(nSize);
+        memcpy(&vchSig[0], pchSig, nSize);
+        return true;
+    }
+
+    // Switch to an equivalent copy of the curve, such as one with the
+    // generator multiples precomputed
+    bool SetGroup(const EC_GROUP* pgroup)
+    {
+        return EC_KEY_set_group(pkey, pgroup) != 0;
+    }
+
     // Verify是比特币核心代码中的一个方法，
     // 用于验证指定哈希值的数字签名是否有效。
     // 数字签名是一种用于验证数据完整性和身份认证的技术，
@@ -252,3 +280,58 @@ public:
         return key.Verify(hash, vchSig);
     }
 };
+
+
+
+// The secp256k1 group with the generator multiples precomputed, shared by
+// every CBatchSigner.  NULL if the precomputation failed.
+const EC_GROUP* GetSigningGroup();
+
+//
+// Signs a run of hashes, as for all the inputs of a new transaction.  Each
+// private key is parsed once and moved onto the precomputed group, and one
+// BN_CTX is used for every signature.  Not thread safe, a thread signing in
+// parallel needs its own.
+//
+class CBatchSigner
+{
+protected:
+    BN_CTX* pctx;
+    map<vector<unsigned char>, CKey*> mapKey;
+
+public:
+    CBatchSigner()
+    {
+        pctx = BN_CTX_new();
+        if (pctx == NULL)
+            throw key_error("CBatchSigner::CBatchSigner() : BN_CTX_new failed");
+    }
+
+    ~CBatchSigner()
+    {
+        for (map<vector<unsigned char>, CKey*>::iterator mi = mapKey.begin(); mi != mapKey.end(); ++mi)
+            delete (*mi).second;
+        BN_CTX_free(pctx);
+    }
+
+    bool Sign(const vector<unsigned char>& vchPubKey, const CPrivKey& vchPrivKey, uint256 hash, vector<unsigned char>& vchSig)
+    {
+        map<vector<unsigned char>, CKey*>::iterator mi = mapKey.find(vchPubKey);
+        if (mi == mapKey.end())
+        {
+            CKey* pkey = new CKey();
+            const EC_GROUP* pgroup = GetSigningGroup();
+            if (!pkey->SetPrivKey(vchPrivKey) || (pgroup && !pkey->SetGroup(pgroup)))
+            {
+                delete pkey;
+                return false;
+            }
+            mi = mapKey.insert(make_pair(vchPubKey, pkey)).first;
+        }
+        return (*mi).second->Sign(hash, vchSig, pctx);
+    }
+
+private:
+    CBatchSigner(const CBatchSigner&);
+    void operator=(const CBatchSigner&);
+};
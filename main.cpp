@@ -3,7 +3,6 @@
 // file license.txt or http://www.opensource.org/licenses/mit-license.php.
 
 #include "headers.h"
-#include "sha.h"
 
 
 
@@ -16,12 +15,12 @@
 // CCriticalSection 是一个临界区（Critical Section）的封装类，用于实现线程同步和互斥。它是比特币代码中常用的一种同步方式，可以保证多个线程对共享资源的访问顺序和正确性。
 CCriticalSection cs_main;
 
-map<uint256, CTransaction> mapTransactions;
+CHashMap<uint256, CTransactionRef> mapTransactions;
 CCriticalSection cs_mapTransactions;
 unsigned int nTransactionsUpdated = 0;
-map<COutPoint, CInPoint> mapNextTx;
+CHashMap<COutPoint, CInPoint> mapNextTx;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+CHashMap<uint256, CBlockIndex*> mapBlockIndex;
 // 创世块哈希值
 const uint256 hashGenesisBlock("0x000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f");
 CBlockIndex* pindexGenesisBlock = NULL;
@@ -29,14 +28,14 @@ int nBestHeight = -1;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 
-map<uint256, CBlock*> mapOrphanBlocks;
+CHashMap<uint256, CBlock*> mapOrphanBlocks;
 multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 
 // 用于存储孤块（Orphan Block）。孤块是指没有被包含在当前区块链上的区块
 map<uint256, CDataStream*> mapOrphanTransactions;
 multimap<uint256, CDataStream*> mapOrphanTransactionsByPrev;
 
-map<uint256, CWalletTx> mapWallet;
+CHashMap<uint256, CWalletTx> mapWallet;
 vector<pair<uint256, bool> > vWalletUpdated;
 CCriticalSection cs_mapWallet;
 
@@ -50,6 +49,11 @@ int nDropMessagesTest = 0;
 
 // Settings
 int fGenerateBitcoins;
+int nMinerThreads = 0;
+int nMinerStatsInterval = 60;
+unsigned int nSigCacheSize = 50000;
+unsigned int nKeyCacheSize = 5000;
+int nScriptCheckPar = 0;
 int64 nTransactionFee = 0;
 CAddress addrIncoming;
 
@@ -105,7 +109,7 @@ bool AddToWallet(const CWalletTx& wtxIn)
     CRITICAL_BLOCK(cs_mapWallet)
     {
         // Inserts only if not already there, returns tx inserted or tx found
-        pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
+        pair<CHashMap<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
         CWalletTx& wtx = (*ret.first).second;
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
@@ -242,7 +246,7 @@ bool CTxIn::IsMine() const
 {
     CRITICAL_BLOCK(cs_mapWallet)
     {
-        map<uint256, CWalletTx>::iterator mi = mapWallet.find(prevout.hash);
+        CHashMap<uint256, CWalletTx>::iterator mi = mapWallet.find(prevout.hash);
         if (mi != mapWallet.end())
         {
             const CWalletTx& prev = (*mi).second;
@@ -258,7 +262,7 @@ int64 CTxIn::GetDebit() const
 {
     CRITICAL_BLOCK(cs_mapWallet)
     {
-        map<uint256, CWalletTx>::iterator mi = mapWallet.find(prevout.hash);
+        CHashMap<uint256, CWalletTx>::iterator mi = mapWallet.find(prevout.hash);
         if (mi != mapWallet.end())
         {
             const CWalletTx& prev = (*mi).second;
@@ -277,7 +281,7 @@ int64 CWalletTx::GetTxTime() const
         // If we did not receive the transaction directly, we rely on the block's
         // time to figure out when it happened.  We use the median over a range
         // of blocks to try to filter out inaccurate block times.
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -334,7 +338,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -413,7 +417,7 @@ void CWalletTx::AddSupportingTransactions(CTxDB& txdb)
 
 
 
-bool CTransaction::AcceptTransaction(CTxDB& txdb, bool fCheckInputs, bool* pfMissingInputs)
+bool CTransaction::AcceptTransaction(CTxDB& txdb, bool fCheckInputs, bool* pfMissingInputs, CDataStream* pvMsg)
 {
     if (pfMissingInputs)
         *pfMissingInputs = false;
@@ -435,7 +439,7 @@ bool CTransaction::AcceptTransaction(CTxDB& txdb, bool fCheckInputs, bool* pfMis
             return false;
 
     // Check for conflicts with in-memory transactions
-    CTransaction* ptxOld = NULL;
+    const CTransaction* ptxOld = NULL;
     for (int i = 0; i < vin.size(); i++)
     {
         COutPoint outpoint = vin[i].prevout;
@@ -468,37 +472,63 @@ bool CTransaction::AcceptTransaction(CTxDB& txdb, bool fCheckInputs, bool* pfMis
     }
 
     // Store transaction in memory
+    uint256 hashOld = 0;
     CRITICAL_BLOCK(cs_mapTransactions)
     {
         if (ptxOld)
         {
-            printf("mapTransaction.erase(%s) replacing with new version\n", ptxOld->GetHash().ToString().c_str());
-            mapTransactions.erase(ptxOld->GetHash());
+            // The pool entry owns ptxOld, take its hash before erasing it
+            hashOld = ptxOld->GetHash();
+            printf("mapTransaction.erase(%s) replacing with new version\n", hashOld.ToString().c_str());
+            mapTransactions.erase(hashOld);
+            NotifyMinerTransaction(hashOld, false);
         }
-        AddToMemoryPool();
+        AddToMemoryPool(pvMsg);
     }
 
     ///// are we sure this is ok when loading transactions or restoring block txes
     // If updated, erase old tx from wallet
     if (ptxOld)
-        EraseFromWallet(ptxOld->GetHash());
+        EraseFromWallet(hashOld);
 
     printf("AcceptTransaction(): accepted %s\n", hash.ToString().substr(0,6).c_str());
     return true;
 }
 
 
-bool CTransaction::AddToMemoryPool()
+CSharedTx::CSharedTx(const CTransaction& txIn, CDataStream* pvMsgIn) : tx(txIn)
+{
+    hash = tx.GetHash();
+    unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK);
+    if (pvMsgIn)
+    {
+        // The caller is done with the message, swap its buffer out
+        CDataStream* pss = new CDataStream(pvMsgIn->nType, pvMsgIn->nVersion);
+        pvMsg.reset(pss);
+        pss->swap(*pvMsgIn);
+    }
+    else
+    {
+        CDataStream* pss = new CDataStream(SER_NETWORK);
+        pvMsg.reset(pss);
+        pss->reserve(nSize);
+        *pss << tx;
+    }
+}
+
+bool CTransaction::AddToMemoryPool(CDataStream* pvMsg)
 {
     // Add to memory pool without checking anything.  Don't call this directly,
     // call AcceptTransaction to properly check the transaction first.
     CRITICAL_BLOCK(cs_mapTransactions)
     {
-        uint256 hash = GetHash();
-        mapTransactions[hash] = *this;
+        CTransactionRef ptx(new CSharedTx(*this, pvMsg));
+        uint256 hash = ptx->hash;
+        mapTransactions[hash] = ptx;
         for (int i = 0; i < vin.size(); i++)
-            mapNextTx[vin[i].prevout] = CInPoint(&mapTransactions[hash], i);
+            mapNextTx[vin[i].prevout] = CInPoint(&ptx->tx, i);
         nTransactionsUpdated++;
+        NotifyMinerTransaction(hash, true);
     }
     return true;
 }
@@ -511,8 +541,10 @@ bool CTransaction::RemoveFromMemoryPool()
     {
         foreach(const CTxIn& txin, vin)
             mapNextTx.erase(txin.prevout);
-        mapTransactions.erase(GetHash());
+        uint256 hash = GetHash();
+        mapTransactions.erase(hash);
         nTransactionsUpdated++;
+        NotifyMinerTransaction(hash, false);
     }
     return true;
 }
@@ -528,7 +560,7 @@ int CMerkleTx::GetDepthInMainChain() const
         return 0;
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -613,7 +645,7 @@ void CWalletTx::RelayWalletTransaction(CTxDB& txdb)
         if (!tx.IsCoinBase())
         {
             uint256 hash = tx.GetHash();
-            if (!txdb.ContainsTx(hash))
+            if (!txdb.ContainsTx(hash) && !RelayMemoryTx(CInv(MSG_TX, hash)))
                 RelayMessage(CInv(MSG_TX, hash), (CTransaction)tx);
         }
     }
@@ -623,7 +655,8 @@ void CWalletTx::RelayWalletTransaction(CTxDB& txdb)
         if (!txdb.ContainsTx(hash))
         {
             printf("Relaying wtx %s\n", hash.ToString().substr(0,6).c_str());
-            RelayMessage(CInv(MSG_TX, hash), (CTransaction)*this);
+            if (!RelayMemoryTx(CInv(MSG_TX, hash)))
+                RelayMessage(CInv(MSG_TX, hash), (CTransaction)*this);
         }
     }
 }
@@ -674,6 +707,39 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pblockindex, bool fReadTransactions
     return ReadFromDisk(pblockindex->nFile, pblockindex->nBlockPos, fReadTransactions);
 }
 
+// Merkle leaves, 64 transactions to a job.  A block just read off the
+// network or disk has no cached hashes yet, big ones are split across the
+// script verification threads.
+struct CTxHashJob
+{
+    const vector<CTransaction>* pvtx;
+    uint256* phash;
+};
+
+static bool TxHashJob(void* parg, unsigned int n)
+{
+    const CTxHashJob& job = *(CTxHashJob*)parg;
+    unsigned int nEnd = min((n + 1) * 64, (unsigned int)job.pvtx->size());
+    for (unsigned int i = n * 64; i < nEnd; i++)
+        job.phash[i] = (*job.pvtx)[i].GetHash();
+    return true;
+}
+
+void GetTransactionHashes(const vector<CTransaction>& vtx, uint256* phashRet)
+{
+    CTxHashJob job;
+    job.pvtx = &vtx;
+    job.phash = phashRet;
+    unsigned int nJobs = (vtx.size() + 63) / 64;
+    if (nJobs < 2)
+    {
+        for (unsigned int n = 0; n < nJobs; n++)
+            TxHashJob(&job, n);
+        return;
+    }
+    RunParallel(TxHashJob, &job, nJobs);
+}
+
 uint256 GetOrphanRoot(const CBlock* pblock)
 {
     // Work back to the first block in the orphan chain
@@ -779,11 +845,13 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
 }
 
 
-bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPool, CDiskTxPos posThisTx, int nHeight, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee)
+bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPool, CDiskTxPos posThisTx, int nHeight, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee,
+                                 vector<CScriptCheck>* pvChecks) const
 {
     // Take over previous transactions' spent pointers
     if (!IsCoinBase())
     {
+        CSignatureHashContext sighash(*this);
         int64 nValueIn = 0;
         for (int i = 0; i < vin.size(); i++)
         {
@@ -806,25 +874,29 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPoo
                 return fMiner ? false : error("ConnectInputs() : %s prev tx %s index entry not found", GetHash().ToString().substr(0,6).c_str(),  prevout.hash.ToString().substr(0,6).c_str());
 
             // Read txPrev
-            CTransaction txPrev;
+            CTransaction txDisk;
+            CTransactionRef ptxMemory;
             if (!fFound || txindex.pos == CDiskTxPos(1,1,1))
             {
-                // Get prev tx from single transactions in memory
+                // Get prev tx from single transactions in memory, holding a
+                // reference instead of copying it
                 CRITICAL_BLOCK(cs_mapTransactions)
                 {
-                    if (!mapTransactions.count(prevout.hash))
+                    CHashMap<uint256, CTransactionRef>::iterator mi = mapTransactions.find(prevout.hash);
+                    if (mi == mapTransactions.end())
                         return error("ConnectInputs() : %s mapTransactions prev not found %s", GetHash().ToString().substr(0,6).c_str(),  prevout.hash.ToString().substr(0,6).c_str());
-                    txPrev = mapTransactions[prevout.hash];
+                    ptxMemory = (*mi).second;
                 }
                 if (!fFound)
-                    txindex.vSpent.resize(txPrev.vout.size());
+                    txindex.vSpent.resize(ptxMemory->tx.vout.size());
             }
             else
             {
                 // Get prev tx from disk
-                if (!txPrev.ReadFromDisk(txindex.pos))
+                if (!txDisk.ReadFromDisk(txindex.pos))
                     return error("ConnectInputs() : %s ReadFromDisk prev tx %s failed", GetHash().ToString().substr(0,6).c_str(),  prevout.hash.ToString().substr(0,6).c_str());
             }
+            const CTransaction& txPrev = (ptxMemory ? ptxMemory->tx : txDisk);
 
             if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.vSpent.size())
                 return error("ConnectInputs() : %s prevout.n out of range %d %d %d", GetHash().ToString().substr(0,6).c_str(), prevout.n, txPrev.vout.size(), txindex.vSpent.size());
@@ -835,8 +907,14 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPoo
                     if (pindex->nBlockPos == txindex.pos.nBlockPos && pindex->nFile == txindex.pos.nFile)
                         return error("ConnectInputs() : tried to spend coinbase at depth %d", nBestHeight - pindex->nHeight);
 
-            // Verify signature
-            if (!VerifySignature(txPrev, *this, i))
+            // Verify signature, or leave it for the caller to run with the rest
+            if (pvChecks)
+            {
+                if (txPrev.GetHash() != prevout.hash)
+                    return error("ConnectInputs() : %s prev tx hash mismatch", GetHash().ToString().substr(0,6).c_str());
+                pvChecks->push_back(CScriptCheck(txPrev.vout[prevout.n].scriptPubKey, this, i));
+            }
+            else if (!VerifySignature(txPrev, *this, i, 0, &sighash))
                 return error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,6).c_str());
 
             // Check for conflicts
@@ -888,20 +966,22 @@ bool CTransaction::ClientConnectInputs()
     // Take over previous transactions' spent pointers
     CRITICAL_BLOCK(cs_mapTransactions)
     {
+        CSignatureHashContext sighash(*this);
         int64 nValueIn = 0;
         for (int i = 0; i < vin.size(); i++)
         {
             // Get prev tx from single transactions in memory
             COutPoint prevout = vin[i].prevout;
-            if (!mapTransactions.count(prevout.hash))
+            CHashMap<uint256, CTransactionRef>::iterator mi = mapTransactions.find(prevout.hash);
+            if (mi == mapTransactions.end())
                 return false;
-            CTransaction& txPrev = mapTransactions[prevout.hash];
+            const CTransaction& txPrev = (*mi).second->tx;
 
             if (prevout.n >= txPrev.vout.size())
                 return false;
 
             // Verify signature
-            if (!VerifySignature(txPrev, *this, i))
+            if (!VerifySignature(txPrev, *this, i, 0, &sighash))
                 return error("ConnectInputs() : VerifySignature failed");
 
             ///// this is redundant with the mapNextTx stuff, not sure which I want to get rid of
@@ -949,17 +1029,32 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
     //// issue here: it doesn't know the version
     unsigned int nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK) - 1 + GetSizeOfCompactSize(vtx.size());
 
+    // Inputs are looked up and marked spent in order, the script checks are
+    // collected and run together on the verification threads at the end
     map<uint256, CTxIndex> mapUnused;
     int64 nFees = 0;
+    vector<CScriptCheck> vChecks;
+    list<CSignatureHashContext> listSigHash;
     foreach(CTransaction& tx, vtx)
     {
         CDiskTxPos posThisTx(pindex->nFile, pindex->nBlockPos, nTxPos);
         nTxPos += ::GetSerializeSize(tx, SER_DISK);
 
-        if (!tx.ConnectInputs(txdb, mapUnused, posThisTx, pindex->nHeight, nFees, true, false))
+        unsigned int nChecks = vChecks.size();
+        if (!tx.ConnectInputs(txdb, mapUnused, posThisTx, pindex->nHeight, nFees, true, false, 0, &vChecks))
             return false;
+        if (vChecks.size() > nChecks)
+        {
+            listSigHash.push_back(CSignatureHashContext(tx));
+            listSigHash.back().Init();
+            for (unsigned int i = nChecks; i < vChecks.size(); i++)
+                vChecks[i].psighash = &listSigHash.back();
+        }
     }
 
+    if (!RunScriptChecks(vChecks))
+        return error("ConnectBlock() : script verification failed");
+
     if (vtx[0].GetValueOut() > GetBlockValue(nFees))
         return false;
 
@@ -1090,9 +1185,9 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
     if (!pindexNew)
         return error("AddToBlockIndex() : new CBlockIndex failed");
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    CHashMap<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
@@ -1144,6 +1239,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         pindexBest = pindexNew;
         nBestHeight = pindexBest->nHeight;
         nTransactionsUpdated++;
+        AbandonMinerWork(true);
         printf("AddToBlockIndex: new best=%s  height=%d\n", hashBestChain.ToString().substr(0,14).c_str(), nBestHeight);
     }
 
@@ -1207,7 +1303,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return error("AcceptBlock() : prev block not found");
     CBlockIndex* pindexPrev = (*mi).second;
@@ -1535,7 +1631,7 @@ void PrintBlockTree()
 {
     // precompute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -1640,6 +1736,22 @@ bool AlreadyHave(CTxDB& txdb, const CInv& inv)
     return true;
 }
 
+// Relay a memory pool transaction with the serialized bytes the pool keeps,
+// false if it isn't in the pool
+bool RelayMemoryTx(const CInv& inv)
+{
+    boost::shared_ptr<const CDataStream> pvMsg;
+    CRITICAL_BLOCK(cs_mapTransactions)
+    {
+        CHashMap<uint256, CTransactionRef>::iterator mi = mapTransactions.find(inv.hash);
+        if (mi == mapTransactions.end())
+            return false;
+        pvMsg = (*mi).second->pvMsg;
+    }
+    RelayMessage(inv, pvMsg);
+    return true;
+}
+
 
 
 
@@ -1648,61 +1760,22 @@ bool AlreadyHave(CTxDB& txdb, const CInv& inv)
 
 bool ProcessMessages(CNode* pfrom)
 {
-    CDataStream& vRecv = pfrom->vRecv;
-    if (vRecv.empty())
+    deque<CNetMessage>& vRecvMsg = pfrom->vRecvMsg;
+    if (!pfrom->RecvMessageReady())
         return true;
-    printf("ProcessMessages(%d bytes)\n", vRecv.size());
+    printf("ProcessMessages(%d messages)\n", vRecvMsg.size());
 
-    //
-    // Message format
-    //  (4) message start
-    //  (12) command
-    //  (4) size
-    //  (x) data
-    //
-
-    loop
+    // The socket thread has already framed the messages, see CNode::ReceiveBytes
+    while (pfrom->RecvMessageReady())
     {
-        // Scan for message start
-        CDataStream::iterator pstart = search(vRecv.begin(), vRecv.end(), BEGIN(pchMessageStart), END(pchMessageStart));
-        if (vRecv.end() - pstart < sizeof(CMessageHeader))
-        {
-            if (vRecv.size() > sizeof(CMessageHeader))
-            {
-                printf("\n\nPROCESSMESSAGE MESSAGESTART NOT FOUND\n\n");
-                vRecv.erase(vRecv.begin(), vRecv.end() - sizeof(CMessageHeader));
-            }
-            break;
-        }
-        if (pstart - vRecv.begin() > 0)
-            printf("\n\nPROCESSMESSAGE SKIPPED %d BYTES\n\n", pstart - vRecv.begin());
-        vRecv.erase(vRecv.begin(), pstart);
-
-        // Read header
-        CMessageHeader hdr;
-        vRecv >> hdr;
-        if (!hdr.IsValid())
-        {
-            printf("\n\nPROCESSMESSAGE: ERRORS IN HEADER %s\n\n\n", hdr.GetCommand().c_str());
-            continue;
-        }
-        string strCommand = hdr.GetCommand();
+        CNetMessage& msg = vRecvMsg.front();
+        string strCommand = msg.hdr.GetCommand();
+        unsigned int nMessageSize = msg.hdr.nMessageSize;
 
-        // Message size
-        unsigned int nMessageSize = hdr.nMessageSize;
-        if (nMessageSize > vRecv.size())
-        {
-            // Rewind and wait for rest of message
-            ///// need a mechanism to give up waiting for overlong message size error
-            printf("MESSAGE-BREAK\n");
-            vRecv.insert(vRecv.begin(), BEGIN(hdr), END(hdr));
-            Sleep(100);
-            break;
-        }
-
-        // Copy message to its own buffer
-        CDataStream vMsg(vRecv.begin(), vRecv.begin() + nMessageSize, vRecv.nType, vRecv.nVersion);
-        vRecv.ignore(nMessageSize);
+        // Type and version may have changed since it was framed
+        CDataStream& vMsg = msg.vRecv;
+        vMsg.SetType(pfrom->vRecv.nType);
+        vMsg.SetVersion(pfrom->vRecv.nVersion);
 
         // Process message
         bool fRet = false;
@@ -1716,9 +1789,9 @@ bool ProcessMessages(CNode* pfrom)
         CATCH_PRINT_EXCEPTION("ProcessMessage()")
         if (!fRet)
             printf("ProcessMessage(%s, %d bytes) from %s to %s FAILED\n", strCommand.c_str(), nMessageSize, pfrom->addr.ToString().c_str(), addrLocalHost.ToString().c_str());
+        vRecvMsg.pop_front();
     }
 
-    vRecv.Compact();
     return true;
 }
 
@@ -1844,7 +1917,7 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (inv.type == MSG_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     //// could optimize this to send header straight from blockindex for client
@@ -1858,9 +1931,9 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 // Send stream from relay memory
                 CRITICAL_BLOCK(cs_mapRelay)
                 {
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    CHashMap<CInv, boost::shared_ptr<const CDataStream> >::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end())
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushMessage(inv.GetCommand(), *(*mi).second);
                 }
             }
         }
@@ -1914,10 +1987,10 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         pfrom->AddInventoryKnown(inv);
 
         bool fMissingInputs = false;
-        if (tx.AcceptTransaction(true, &fMissingInputs))
+        if (tx.AcceptTransaction(true, &fMissingInputs, &vMsg))
         {
             AddToWalletIfMine(tx, NULL);
-            RelayMessage(inv, vMsg);
+            RelayMemoryTx(inv);
             mapAlreadyAskedFor.erase(inv);
             vWorkQueue.push_back(inv.hash);
 
@@ -1929,16 +2002,17 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                      mi != mapOrphanTransactionsByPrev.upper_bound(hashPrev);
                      ++mi)
                 {
-                    const CDataStream& vMsg = *((*mi).second);
+                    // The orphan map keeps its stream until EraseOrphanTx
+                    CDataStream vMsg(*((*mi).second));
                     CTransaction tx;
                     CDataStream(vMsg) >> tx;
                     CInv inv(MSG_TX, tx.GetHash());
 
-                    if (tx.AcceptTransaction(true))
+                    if (tx.AcceptTransaction(true, NULL, &vMsg))
                     {
                         printf("   accepted orphan tx %s\n", inv.hash.ToString().substr(0,6).c_str());
                         AddToWalletIfMine(tx, NULL);
-                        RelayMessage(inv, vMsg);
+                        RelayMemoryTx(inv);
                         mapAlreadyAskedFor.erase(inv);
                         vWorkQueue.push_back(inv.hash);
                     }
@@ -2193,6 +2267,12 @@ int FormatHashBlocks(void* pbuffer, unsigned int len)
 using CryptoPP::ByteReverse;
 static int detectlittleendian = 1;
 
+inline unsigned int SHA256Word(unsigned int n)
+{
+    // SHA-256 works on big-endian words
+    return (*(char*)&detectlittleendian != 0) ? ByteReverse(n) : n;
+}
+
 void BlockSHA256(const void* pin, unsigned int nBlocks, void* pout)
 {
     unsigned int* pinput = (unsigned int*)pin;
@@ -2220,14 +2300,608 @@ void BlockSHA256(const void* pin, unsigned int nBlocks, void* pout)
 }
 
 
-bool BitcoinMiner()
+//
+// Shared block template.  All miner threads mine the same set of
+// transactions, each with its own coinbase, so they never search the same
+// header space.
+//
+// The template is kept up to date incrementally.  Memory pool changes are
+// queued by NotifyMinerTransaction and applied the next time the template is
+// refreshed.  Each transaction in the template keeps an undo log of the
+// mapMinerTestPool entries it changed, so one can be taken out by undoing
+// back to it and replaying the transactions after it.  Only a new best
+// block rebuilds the whole thing, picking transactions together with their
+// unconfirmed ancestors in order of fee per byte.
+//
+class CMinerTxUndo
+{
+public:
+    uint256 hash;
+    bool fExisted;
+    CTxIndex txindex;
+};
+
+class CMinerTemplateTx
+{
+public:
+    CTransactionRef ptx;
+    uint256 hash;
+    int64 nFee;
+    unsigned int nSize;
+    vector<CMinerTxUndo> vUndo;
+};
+
+class CMinerTxInfo
+{
+public:
+    int64 nFee;
+    unsigned int nSize;
+};
+
+CCriticalSection cs_BitcoinMiner;
+static vector<CMinerTemplateTx> vMinerTemplate;
+static map<uint256, unsigned int> mapMinerTemplateIndex;
+static map<uint256, CTxIndex> mapMinerTestPool;
+static set<uint256> setMinerWaiting;
+static map<uint256, CMinerTxInfo> mapMinerTxInfo;
+static vector<uint256> vMinerMerkleBranch;
+static CBlockIndex* pindexMinerTemplate = NULL;
+static unsigned int nMinerTemplateBits = 0;
+static int64 nMinerTemplateFees = 0;
+static unsigned int nMinerTemplateSize = 0;
+static unsigned int nMinerTemplateTxUpdated = 0;
+static int64 nMinerTemplateTime = 0;
+static int64 nMinerTemplateMicros = 0;
+static volatile unsigned int nMinerWork = 0;
+
+// Protected by cs_mapTransactions, NotifyMinerTransaction drops the queue
+// and clears fMinerTemplateValid together
+static bool fMinerTemplateValid = false;
+static vector<uint256> vMinerAdded;
+static vector<uint256> vMinerRemoved;
+
+void AbandonMinerWork(bool fNewTip)
+{
+    // A new best block makes all current work worthless.  New transactions
+    // are only worth a restart once the template is a minute old.
+    if (fNewTip || GetTime() - nMinerTemplateTime > 60)
+        nMinerWork++;
+}
+
+void NotifyMinerTransaction(const uint256& hash, bool fAdded)
+{
+    CRITICAL_BLOCK(cs_mapTransactions)
+    {
+        if (fMinerTemplateValid)
+        {
+            if (!fGenerateBitcoins && !fWorkServer)
+            {
+                // Nobody is consuming the queue, start over when mining resumes
+                fMinerTemplateValid = false;
+                vMinerAdded.clear();
+                vMinerRemoved.clear();
+            }
+            else if (fAdded)
+                vMinerAdded.push_back(hash);
+            else
+                vMinerRemoved.push_back(hash);
+        }
+    }
+    AbandonMinerWork(false);
+}
+
+static void UndoMinerTx(const vector<CMinerTxUndo>& vUndo)
+{
+    for (int i = vUndo.size() - 1; i >= 0; i--)
+    {
+        if (vUndo[i].fExisted)
+            mapMinerTestPool[vUndo[i].hash] = vUndo[i].txindex;
+        else
+            mapMinerTestPool.erase(vUndo[i].hash);
+    }
+}
+
+static void RecordMinerUndo(vector<CMinerTxUndo>& vUndo, const uint256& hash)
+{
+    CMinerTxUndo undo;
+    undo.hash = hash;
+    map<uint256, CTxIndex>::iterator mi = mapMinerTestPool.find(hash);
+    undo.fExisted = (mi != mapMinerTestPool.end());
+    if (undo.fExisted)
+        undo.txindex = (*mi).second;
+    vUndo.push_back(undo);
+}
+
+static bool AddToMinerTemplate(CTxDB& txdb, const uint256& hash, const CTransactionRef& ptx)
+{
+    const CTransaction& tx = ptx->tx;
+    if (tx.IsCoinBase() || !tx.IsFinal())
+        return false;
+    if (nMinerTemplateSize >= MAX_SIZE/2)
+        return false;
+
+    // ConnectInputs only touches the entries of the transactions it spends
+    // and its own, note what they were so a failed attempt can be undone
+    CMinerTemplateTx entry;
+    foreach(const CTxIn& txin, tx.vin)
+        RecordMinerUndo(entry.vUndo, txin.prevout.hash);
+    RecordMinerUndo(entry.vUndo, hash);
+
+    // Transaction fee requirements, mainly only needed for flood control
+    // Under 10K (about 80 inputs) is free for first 100 transactions
+    // Base rate is 0.01 per KB
+    int64 nMinFee = tx.GetMinFee(vMinerTemplate.size() + 1 < 100);
+
+    int64 nFee = 0;
+    if (!tx.ConnectInputs(txdb, mapMinerTestPool, CDiskTxPos(1,1,1), 0, nFee, false, true, nMinFee))
+    {
+        UndoMinerTx(entry.vUndo);
+        return false;
+    }
+
+    entry.ptx = ptx;
+    entry.hash = hash;
+    entry.nFee = nFee;
+    entry.nSize = ::GetSerializeSize(tx, SER_NETWORK);
+    mapMinerTemplateIndex[hash] = vMinerTemplate.size();
+    mapMinerTxInfo[hash].nFee = nFee;
+    mapMinerTxInfo[hash].nSize = entry.nSize;
+    vMinerTemplate.push_back(entry);
+    nMinerTemplateFees += nFee;
+    nMinerTemplateSize += entry.nSize;
+    return true;
+}
+
+static void AddWaitingToMinerTemplate(CTxDB& txdb, vector<uint256>& vWork)
+{
+    // vWork is used as a stack.  Whenever a transaction gets in, any waiting
+    // memory pool transactions spending it are tried right after.
+    while (!vWork.empty())
+    {
+        uint256 hash = vWork.back();
+        vWork.pop_back();
+        if (!setMinerWaiting.count(hash))
+            continue;
+        CHashMap<uint256, CTransactionRef>::iterator mi = mapTransactions.find(hash);
+        if (mi == mapTransactions.end())
+        {
+            setMinerWaiting.erase(hash);
+            continue;
+        }
+        CTransactionRef ptx = (*mi).second;
+        if (!AddToMinerTemplate(txdb, hash, ptx))
+            continue;
+        setMinerWaiting.erase(hash);
+
+        for (int n = ptx->tx.vout.size() - 1; n >= 0; n--)
+        {
+            CHashMap<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, n));
+            if (it != mapNextTx.end())
+                vWork.push_back((*it).second.ptx->GetHash());
+        }
+    }
+}
+
+static void RemoveFromMinerTemplate(CTxDB& txdb, const uint256& hash)
+{
+    setMinerWaiting.erase(hash);
+    map<uint256, unsigned int>::iterator mi = mapMinerTemplateIndex.find(hash);
+    if (mi == mapMinerTemplateIndex.end())
+        return;
+    unsigned int nPos = (*mi).second;
+
+    // Unwind to the transaction, then replay the ones that came after it
+    vector<uint256> vWork;
+    while (vMinerTemplate.size() > nPos)
+    {
+        CMinerTemplateTx& entry = vMinerTemplate.back();
+        UndoMinerTx(entry.vUndo);
+        nMinerTemplateFees -= entry.nFee;
+        nMinerTemplateSize -= entry.nSize;
+        mapMinerTemplateIndex.erase(entry.hash);
+        if (entry.hash != hash)
+        {
+            setMinerWaiting.insert(entry.hash);
+            vWork.push_back(entry.hash);
+        }
+        vMinerTemplate.pop_back();
+    }
+    AddWaitingToMinerTemplate(txdb, vWork);
+}
+
+static bool GetMinerTxInfo(CTxDB& txdb, const uint256& hash, const CTransaction& tx, CMinerTxInfo& info)
+{
+    map<uint256, CMinerTxInfo>::iterator mi = mapMinerTxInfo.find(hash);
+    if (mi != mapMinerTxInfo.end())
+    {
+        info = (*mi).second;
+        return true;
+    }
+
+    int64 nValueIn = 0;
+    foreach(const CTxIn& txin, tx.vin)
+    {
+        const COutPoint& prevout = txin.prevout;
+        CTransaction txDisk;
+        const CTransaction* ptxPrev = &txDisk;
+        CHashMap<uint256, CTransactionRef>::iterator mp = mapTransactions.find(prevout.hash);
+        if (mp != mapTransactions.end())
+        {
+            ptxPrev = &(*mp).second->tx;
+        }
+        else
+        {
+            CTxIndex txindex;
+            if (!txdb.ReadTxIndex(prevout.hash, txindex) || !txDisk.ReadFromDisk(txindex.pos))
+                return false;
+        }
+        if (prevout.n >= ptxPrev->vout.size())
+            return false;
+        nValueIn += ptxPrev->vout[prevout.n].nValue;
+    }
+    info.nFee = nValueIn - tx.GetValueOut();
+    info.nSize = ::GetSerializeSize(tx, SER_NETWORK);
+    mapMinerTxInfo[hash] = info;
+    return true;
+}
+
+// A candidate transaction together with its memory pool ancestors that are
+// not in the template yet.  Mining it means mining all of them.
+class CMinerPackage
+{
+public:
+    CTransactionRef ptx;
+    CMinerTxInfo info;
+    unsigned int nAncestorsTotal;
+    set<uint256> setAncestors;
+    int64 nFee;
+    unsigned int nSize;
+    bool fQueued;
+    multimap<double, uint256>::iterator itQueue;
+};
+
+static void ResetMinerTemplate(CTxDB& txdb)
+{
+    vMinerTemplate.clear();
+    mapMinerTemplateIndex.clear();
+    mapMinerTestPool.clear();
+    setMinerWaiting.clear();
+    nMinerTemplateFees = 0;
+    nMinerTemplateSize = 0;
+    vMinerAdded.clear();
+    vMinerRemoved.clear();
+
+    // Forget fees of transactions that have left the memory pool
+    if (mapMinerTxInfo.size() > mapTransactions.size())
+    {
+        for (map<uint256, CMinerTxInfo>::iterator mi = mapMinerTxInfo.begin(); mi != mapMinerTxInfo.end();)
+        {
+            if (mapTransactions.count((*mi).first))
+                ++mi;
+            else
+                mapMinerTxInfo.erase(mi++);
+        }
+    }
+
+    // Candidates are final transactions whose inputs can all be found
+    map<uint256, CMinerPackage> mapPackage;
+    for (CHashMap<uint256, CTransactionRef>::iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi)
+    {
+        setMinerWaiting.insert((*mi).first);
+        const CTransaction& tx = (*mi).second->tx;
+        if (tx.IsCoinBase() || !tx.IsFinal())
+            continue;
+        CMinerTxInfo info;
+        if (!GetMinerTxInfo(txdb, (*mi).first, tx, info))
+            continue;
+        CMinerPackage& package = mapPackage[(*mi).first];
+        package.ptx = (*mi).second;
+        package.info = info;
+        package.nAncestorsTotal = 0;
+        package.nFee = 0;
+        package.nSize = 0;
+        package.fQueued = false;
+    }
+
+    // Build each candidate's ancestor set from the prevouts.  Anything
+    // depending on a memory pool transaction that isn't a candidate can't be
+    // mined and is dropped.
+    multimap<double, uint256> mapQueue;
+    for (map<uint256, CMinerPackage>::iterator mi = mapPackage.begin(); mi != mapPackage.end(); ++mi)
+    {
+        CMinerPackage& package = (*mi).second;
+        bool fMinable = true;
+        vector<const CTransaction*> vWork(1, &package.ptx->tx);
+        while (fMinable && !vWork.empty())
+        {
+            const CTransaction* ptx = vWork.back();
+            vWork.pop_back();
+            foreach(const CTxIn& txin, ptx->vin)
+            {
+                const uint256& hashPrev = txin.prevout.hash;
+                if (!mapTransactions.count(hashPrev) || package.setAncestors.count(hashPrev))
+                    continue;
+                map<uint256, CMinerPackage>::iterator mp = mapPackage.find(hashPrev);
+                if (mp == mapPackage.end())
+                {
+                    fMinable = false;
+                    break;
+                }
+                package.setAncestors.insert(hashPrev);
+                vWork.push_back(&(*mp).second.ptx->tx);
+            }
+        }
+        if (!fMinable)
+            continue;
+
+        package.nAncestorsTotal = package.setAncestors.size();
+        package.nFee = package.info.nFee;
+        package.nSize = package.info.nSize;
+        foreach(const uint256& hashPrev, package.setAncestors)
+        {
+            package.nFee += mapPackage[hashPrev].info.nFee;
+            package.nSize += mapPackage[hashPrev].info.nSize;
+        }
+        package.itQueue = mapQueue.insert(make_pair((double)package.nFee / package.nSize, (*mi).first));
+        package.fQueued = true;
+    }
+
+    // Greedily take the package with the best fee per byte.  Once part of a
+    // package is in, the packages of its descendants shrink and are requeued
+    // at their new rate.
+    set<uint256> setFailed;
+    while (!mapQueue.empty())
+    {
+        multimap<double, uint256>::iterator itBest = --mapQueue.end();
+        uint256 hash = (*itBest).second;
+        CMinerPackage& package = mapPackage[hash];
+        mapQueue.erase(itBest);
+        package.fQueued = false;
+        if (nMinerTemplateSize + package.nSize > MAX_SIZE/2)
+            continue;
+        bool fFailed = false;
+        foreach(const uint256& hashPrev, package.setAncestors)
+            if (setFailed.count(hashPrev))
+                fFailed = true;
+        if (fFailed)
+            continue;
+
+        // An ancestor always has fewer ancestors than its descendants, so
+        // sorting on that count puts parents first
+        vector<pair<unsigned int, uint256> > vInclude;
+        foreach(const uint256& hashPrev, package.setAncestors)
+            vInclude.push_back(make_pair(mapPackage[hashPrev].nAncestorsTotal, hashPrev));
+        sort(vInclude.begin(), vInclude.end());
+        vInclude.push_back(make_pair(package.nAncestorsTotal, hash));
+
+        for (int i = 0; i < vInclude.size(); i++)
+        {
+            const uint256& hashTx = vInclude[i].second;
+            CMinerPackage& packageTx = mapPackage[hashTx];
+            if (packageTx.fQueued)
+            {
+                mapQueue.erase(packageTx.itQueue);
+                packageTx.fQueued = false;
+            }
+            if (!AddToMinerTemplate(txdb, hashTx, packageTx.ptx))
+            {
+                setFailed.insert(hashTx);
+                break;
+            }
+            setMinerWaiting.erase(hashTx);
+
+            // Take it out of every descendant's package
+            set<uint256> setVisited;
+            vector<uint256> vWork(1, hashTx);
+            while (!vWork.empty())
+            {
+                uint256 hashParent = vWork.back();
+                vWork.pop_back();
+                const CTransaction& txParent = mapPackage[hashParent].ptx->tx;
+                for (int n = 0; n < txParent.vout.size(); n++)
+                {
+                    CHashMap<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hashParent, n));
+                    if (it == mapNextTx.end())
+                        continue;
+                    uint256 hashChild = (*it).second.ptx->GetHash();
+                    map<uint256, CMinerPackage>::iterator mp = mapPackage.find(hashChild);
+                    if (mp == mapPackage.end() || !setVisited.insert(hashChild).second)
+                        continue;
+                    CMinerPackage& packageChild = (*mp).second;
+                    vWork.push_back(hashChild);
+                    if (!packageChild.setAncestors.erase(hashTx))
+                        continue;
+                    packageChild.nFee -= packageTx.info.nFee;
+                    packageChild.nSize -= packageTx.info.nSize;
+                    if (packageChild.fQueued)
+                    {
+                        mapQueue.erase(packageChild.itQueue);
+                        packageChild.itQueue = mapQueue.insert(make_pair((double)packageChild.nFee / packageChild.nSize, hashChild));
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void UpdateMinerTemplate(CTxDB& txdb)
+{
+    foreach(const uint256& hash, vMinerRemoved)
+    {
+        RemoveFromMinerTemplate(txdb, hash);
+        mapMinerTxInfo.erase(hash);
+    }
+    vMinerRemoved.clear();
+
+    vector<uint256> vWork;
+    for (int i = vMinerAdded.size() - 1; i >= 0; i--)
+    {
+        if (mapMinerTemplateIndex.count(vMinerAdded[i]))
+            continue;
+        setMinerWaiting.insert(vMinerAdded[i]);
+        vWork.push_back(vMinerAdded[i]);
+    }
+    vMinerAdded.clear();
+    AddWaitingToMinerTemplate(txdb, vWork);
+}
+
+static void BuildMinerMerkleBranch()
+{
+    // The coinbase's merkle branch doesn't depend on the coinbase, so it is
+    // worked out once per template from the cached hashes and each thread
+    // only hashes its own path to the root
+    vMinerMerkleBranch.clear();
+    vector<uint256> vLevel(vMinerTemplate.size() + 1);
+    for (int i = 0; i < vMinerTemplate.size(); i++)
+        vLevel[i + 1] = vMinerTemplate[i].hash;
+    while (vLevel.size() > 1)
+    {
+        vMinerMerkleBranch.push_back(vLevel[1]);
+        int nSize = vLevel.size();
+        int nPairs = nSize / 2;
+        vector<uint256> vNext((nSize + 1) / 2);
+        CryptoPP::SHA256_DoubleHash64((unsigned char*)&vNext[0], (unsigned char*)&vLevel[0], nPairs);
+        if (nSize & 1)
+            vNext[nPairs] = Hash(BEGIN(vLevel[nSize-1]), END(vLevel[nSize-1]),
+                                 BEGIN(vLevel[nSize-1]), END(vLevel[nSize-1]));
+        vLevel.swap(vNext);
+    }
+}
+
+bool GetMinerTemplate(CBlock& block, vector<uint256>& vMerkleBranch, CBlockIndex*& pindexPrev, unsigned int& nBits, int64& nFees, unsigned int& nTransactionsUpdatedLast, int64& nTemplateTime)
 {
-    printf("BitcoinMiner started\n");
+    CRITICAL_BLOCK(cs_BitcoinMiner)
+    {
+        bool fStale = true;
+        CRITICAL_BLOCK(cs_mapTransactions)
+            fStale = (!fMinerTemplateValid || pindexMinerTemplate != pindexBest ||
+                      (nMinerTemplateTxUpdated != nTransactionsUpdated && GetTime() - nMinerTemplateTime > 60));
+        if (fStale)
+        {
+            int64 nStart = GetTimeMicros();
+            CRITICAL_BLOCK(cs_main)
+            CRITICAL_BLOCK(cs_mapTransactions)
+            {
+                CTxDB txdb("r");
+                nMinerTemplateTxUpdated = nTransactionsUpdated;
+                nMinerTemplateTime = GetTime();
+                if (!fMinerTemplateValid || pindexMinerTemplate != pindexBest)
+                {
+                    pindexMinerTemplate = pindexBest;
+                    nMinerTemplateBits = GetNextWorkRequired(pindexMinerTemplate);
+                    ResetMinerTemplate(txdb);
+                    fMinerTemplateValid = true;
+                }
+                else
+                {
+                    UpdateMinerTemplate(txdb);
+                }
+            }
+            BuildMinerMerkleBranch();
+            nMinerTemplateMicros = GetTimeMicros() - nStart;
+        }
+
+        // First slot is left for each thread's coinbase
+        block.vtx.resize(1);
+        block.vtx.reserve(vMinerTemplate.size() + 1);
+        foreach(const CMinerTemplateTx& entry, vMinerTemplate)
+            block.vtx.push_back(entry.ptx->tx);
+        vMerkleBranch = vMinerMerkleBranch;
+        pindexPrev = pindexMinerTemplate;
+        nBits = nMinerTemplateBits;
+        nFees = nMinerTemplateFees;
+        nTransactionsUpdatedLast = nMinerTemplateTxUpdated;
+        nTemplateTime = nMinerTemplateTime;
+    }
+    return true;
+}
+
+
+
+//
+// Miner statistics, each thread adds its hash count and timings as it goes
+// and whichever thread reports after the interval is up writes a line to
+// the debug log with the totals since the last one
+//
+class CMinerStats
+{
+public:
+    int64 nHashes;
+    int64 nHashMicros;
+    int64 nTemplateMicros;
+    int nTemplates;
+
+    CMinerStats()
+    {
+        nHashes = 0;
+        nHashMicros = 0;
+        nTemplateMicros = 0;
+        nTemplates = 0;
+    }
+};
+
+static CCriticalSection cs_MinerStats;
+static vector<CMinerStats> vMinerStats;
+static int64 nMinerStatsTime = 0;
+
+void AddMinerStats(unsigned int nThread, int64 nHashes, int64 nHashMicros, int64 nTemplateMicros)
+{
+    CRITICAL_BLOCK(cs_MinerStats)
+    {
+        if (vMinerStats.size() <= nThread)
+            vMinerStats.resize(nThread + 1);
+        CMinerStats& stats = vMinerStats[nThread];
+        stats.nHashes += nHashes;
+        stats.nHashMicros += nHashMicros;
+        if (nTemplateMicros)
+        {
+            stats.nTemplateMicros += nTemplateMicros;
+            stats.nTemplates++;
+        }
+
+        int64 nNow = GetTimeMicros();
+        if (nMinerStatsTime == 0)
+            nMinerStatsTime = nNow;
+        if (nNow - nMinerStatsTime >= (int64)nMinerStatsInterval * 1000000)
+        {
+            // Per thread rate is over the time it spent hashing, the total
+            // is over wall time so it shows time lost between templates
+            CMinerStats total;
+            string strThreads;
+            foreach(CMinerStats& s, vMinerStats)
+            {
+                strThreads += strprintf(" %.2f", s.nHashMicros ? (double)s.nHashes / s.nHashMicros : 0.0);
+                total.nHashes += s.nHashes;
+                total.nHashMicros += s.nHashMicros;
+                total.nTemplateMicros += s.nTemplateMicros;
+                total.nTemplates += s.nTemplates;
+                s = CMinerStats();
+            }
+            int64 nBusy = total.nHashMicros + total.nTemplateMicros;
+            printf("BitcoinMiner stats: %.2f Mhash/s, threads%s, %.1f%% hashing, %d templates %.1fms avg, last build %.1fms, template age %ds\n",
+                   (double)total.nHashes / (nNow - nMinerStatsTime),
+                   strThreads.c_str(),
+                   nBusy ? 100.0 * total.nHashMicros / nBusy : 0.0,
+                   total.nTemplates,
+                   total.nTemplates ? total.nTemplateMicros / 1000.0 / total.nTemplates : 0.0,
+                   nMinerTemplateMicros / 1000.0,
+                   (int)(GetTime() - nMinerTemplateTime));
+            nMinerStatsTime = nNow;
+        }
+    }
+}
+
+
+bool BitcoinMiner(unsigned int nThread, unsigned int nThreads)
+{
+    printf("BitcoinMiner %u of %u started\n", nThread + 1, nThreads);
     SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
 
     CKey key;
     key.MakeNewKey();
-    CBigNum bnExtraNonce = 0;
+
+    // Each thread only uses extranonces congruent to its index
+    CBigNum bnExtraNonce = nThread;
     while (fGenerateBitcoins)
     {
         Sleep(50);
@@ -2238,21 +2912,9 @@ bool BitcoinMiner()
             CheckForShutdown(3);
         }
 
-        unsigned int nTransactionsUpdatedLast = nTransactionsUpdated;
-        CBlockIndex* pindexPrev = pindexBest;
-        unsigned int nBits = GetNextWorkRequired(pindexPrev);
-
-
-        //
-        // Create coinbase tx
-        //
-        CTransaction txNew;
-        txNew.vin.resize(1);
-        txNew.vin[0].prevout.SetNull();
-        txNew.vin[0].scriptSig << nBits << ++bnExtraNonce;
-        txNew.vout.resize(1);
-        txNew.vout[0].scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
-
+        // Read before the template so no abandon notification is missed
+        unsigned int nMinerWorkLast = nMinerWork;
+        int64 nTemplateStart = GetTimeMicros();
 
         //
         // Create new block
@@ -2261,51 +2923,31 @@ bool BitcoinMiner()
         if (!pblock.get())
             return false;
 
-        // Add our coinbase tx as first transaction
-        pblock->vtx.push_back(txNew);
-
-        // Collect the latest transactions into the block
-        int64 nFees = 0;
-        CRITICAL_BLOCK(cs_main)
-        CRITICAL_BLOCK(cs_mapTransactions)
-        {
-            CTxDB txdb("r");
-            map<uint256, CTxIndex> mapTestPool;
-            vector<char> vfAlreadyAdded(mapTransactions.size());
-            bool fFoundSomething = true;
-            unsigned int nBlockSize = 0;
-            while (fFoundSomething && nBlockSize < MAX_SIZE/2)
-            {
-                fFoundSomething = false;
-                unsigned int n = 0;
-                for (map<uint256, CTransaction>::iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi, ++n)
-                {
-                    if (vfAlreadyAdded[n])
-                        continue;
-                    CTransaction& tx = (*mi).second;
-                    if (tx.IsCoinBase() || !tx.IsFinal())
-                        continue;
+        CBlockIndex* pindexPrev;
+        unsigned int nBits;
+        int64 nFees;
+        unsigned int nTransactionsUpdatedLast;
+        int64 nTemplateTime;
+        vector<uint256> vMerkleBranch;
+        if (!GetMinerTemplate(*pblock, vMerkleBranch, pindexPrev, nBits, nFees, nTransactionsUpdatedLast, nTemplateTime))
+            return false;
 
-                    // Transaction fee requirements, mainly only needed for flood control
-                    // Under 10K (about 80 inputs) is free for first 100 transactions
-                    // Base rate is 0.01 per KB
-                    int64 nMinFee = tx.GetMinFee(pblock->vtx.size() < 100);
 
-                    map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
-                    if (!tx.ConnectInputs(txdb, mapTestPoolTmp, CDiskTxPos(1,1,1), 0, nFees, false, true, nMinFee))
-                        continue;
-                    swap(mapTestPool, mapTestPoolTmp);
+        //
+        // Create coinbase tx
+        //
+        CTransaction txNew;
+        txNew.vin.resize(1);
+        txNew.vin[0].prevout.SetNull();
+        txNew.vin[0].scriptSig << nBits << (bnExtraNonce += nThreads);
+        txNew.vout.resize(1);
+        txNew.vout[0].scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+        txNew.vout[0].nValue = pblock->GetBlockValue(nFees);
 
-                    pblock->vtx.push_back(tx);
-                    nBlockSize += ::GetSerializeSize(tx, SER_NETWORK);
-                    vfAlreadyAdded[n] = true;
-                    fFoundSomething = true;
-                }
-            }
-        }
+        // Our coinbase goes in the slot the template left for it
+        pblock->vtx[0] = txNew;
         pblock->nBits = nBits;
-        pblock->vtx[0].vout[0].nValue = pblock->GetBlockValue(nFees);
-        printf("\n\nRunning BitcoinMiner with %d transactions in block\n", pblock->vtx.size());
+        printf("\n\nRunning BitcoinMiner %u with %d transactions in block\n", nThread + 1, pblock->vtx.size());
 
 
         //
@@ -2324,37 +2966,73 @@ bool BitcoinMiner()
             }
             block;
             unsigned char pchPadding0[64];
-            uint256 hash1;
-            unsigned char pchPadding1[64];
         }
         tmp;
 
         tmp.block.nVersion       = pblock->nVersion;
         tmp.block.hashPrevBlock  = pblock->hashPrevBlock  = (pindexPrev ? pindexPrev->GetBlockHash() : 0);
-        tmp.block.hashMerkleRoot = pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+        tmp.block.hashMerkleRoot = pblock->hashMerkleRoot = CBlock::CheckMerkleBranch(txNew.GetHash(), vMerkleBranch, 0);
         tmp.block.nTime          = pblock->nTime          = max((pindexPrev ? pindexPrev->GetMedianTimePast()+1 : 0), GetAdjustedTime());
         tmp.block.nBits          = pblock->nBits          = nBits;
-        tmp.block.nNonce         = pblock->nNonce         = 1;
+        tmp.block.nNonce         = pblock->nNonce         = 0;
 
         unsigned int nBlocks0 = FormatHashBlocks(&tmp.block, sizeof(tmp.block));
-        unsigned int nBlocks1 = FormatHashBlocks(&tmp.hash1, sizeof(tmp.hash1));
+        assert(nBlocks0 == 2);
+
+        // Byte swap the padded header into SHA-256 word order
+        unsigned int pdata[32];
+        for (int i = 0; i < 32; i++)
+            pdata[i] = SHA256Word(((unsigned int*)&tmp)[i]);
+
+        // The first chunk only changes with the template, hash it once
+        unsigned int pmidstate[8];
+        CryptoPP::SHA256::InitState(pmidstate);
+        CryptoPP::SHA256::Transform(pmidstate, pdata);
+
+        // Word of the second chunk that changes with nTime, the nonce word
+        // is filled in per lane by SHA256_DoubleHashMidstateNonces
+        unsigned int& nTimeData  = pdata[16 + 1];
 
 
         //
         // Search
         //
-        unsigned int nStart = GetTime();
         uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
         uint256 hash;
+        const unsigned int nLanes = CryptoPP::SHA256_Lanes();
+        unsigned int pnonce[8];
+        unsigned int phash[8 * 8];
+        int64 nHashStart = GetTimeMicros();
+        unsigned int nNonceStart = 0;
+        AddMinerStats(nThread, 0, 0, max(nHashStart - nTemplateStart, (int64)1));
         loop
         {
-            BlockSHA256(&tmp.block, nBlocks0, &tmp.hash1);
-            BlockSHA256(&tmp.hash1, nBlocks1, &hash);
-
+            // Try one nonce per SIMD lane
+            for (unsigned int i = 0; i < nLanes; i++)
+                pnonce[i] = SHA256Word(tmp.block.nNonce + i);
+            CryptoPP::SHA256_DoubleHashMidstateNonces(phash, pmidstate, pdata + 16, pnonce);
+
+            // The top 32 bits of any target are zero, so only byte swap the
+            // whole hash for a full compare when the last state word is zero
+            unsigned int nFound = nLanes;
+            for (unsigned int i = 0; i < nLanes; i++)
+            {
+                if (phash[8*i + 7] == 0)
+                {
+                    for (int j = 0; j < 8; j++)
+                        ((unsigned int*)&hash)[j] = SHA256Word(phash[8*i + j]);
+                    if (hash <= hashTarget)
+                    {
+                        nFound = i;
+                        break;
+                    }
+                }
+            }
 
-            if (hash <= hashTarget)
+            if (nFound < nLanes)
             {
-                pblock->nNonce = tmp.block.nNonce;
+                AddMinerStats(nThread, tmp.block.nNonce + nLanes - nNonceStart, GetTimeMicros() - nHashStart, 0);
+                pblock->nNonce = tmp.block.nNonce + nFound;
                 assert(hash == pblock->GetHash());
 
                     //// debug print
@@ -2380,19 +3058,41 @@ bool BitcoinMiner()
                 break;
             }
 
-            // Update nTime every few seconds
-            if ((++tmp.block.nNonce & 0x3ffff) == 0)
+            // New best block, stale transactions, shutdown or generation
+            // turned off all abandon every thread's work through nMinerWork
+            if (nMinerWork != nMinerWorkLast)
+            {
+                AddMinerStats(nThread, tmp.block.nNonce + nLanes - nNonceStart, GetTimeMicros() - nHashStart, 0);
+                break;
+            }
+
+            // Update nTime every few seconds, nLanes is a power of two so
+            // the nonce still lands on each multiple of 0x40000
+            tmp.block.nNonce += nLanes;
+            if ((tmp.block.nNonce & 0x3ffff) == 0)
             {
+                int64 nNow = GetTimeMicros();
+                AddMinerStats(nThread, tmp.block.nNonce - nNonceStart, nNow - nHashStart, 0);
+                nHashStart = nNow;
+                nNonceStart = tmp.block.nNonce;
                 CheckForShutdown(3);
                 if (tmp.block.nNonce == 0)
-                    break;
-                if (pindexPrev != pindexBest)
-                    break;
-                if (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60)
-                    break;
-                if (!fGenerateBitcoins)
+                {
+                    // Out of nonces, roll the extranonce.  Only the coinbase's
+                    // path to the merkle root has to be hashed again.
+                    txNew.vin[0].scriptSig = CScript() << nBits << (bnExtraNonce += nThreads);
+                    txNew.SetModified();
+                    pblock->vtx[0] = txNew;
+                    tmp.block.hashMerkleRoot = pblock->hashMerkleRoot = CBlock::CheckMerkleBranch(txNew.GetHash(), vMerkleBranch, 0);
+                    for (int i = 0; i < 32; i++)
+                        pdata[i] = SHA256Word(((unsigned int*)&tmp)[i]);
+                    CryptoPP::SHA256::InitState(pmidstate);
+                    CryptoPP::SHA256::Transform(pmidstate, pdata);
+                }
+                if (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nTemplateTime > 60)
                     break;
                 tmp.block.nTime = pblock->nTime = max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
+                nTimeData = SHA256Word(tmp.block.nTime);
             }
         }
     }
@@ -2431,7 +3131,7 @@ int64 GetBalance()
     int64 nTotal = 0;
     CRITICAL_BLOCK(cs_mapWallet)
     {
-        for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (CHashMap<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsFinal() || pcoin->fSpent)
@@ -2459,7 +3159,7 @@ bool SelectCoins(int64 nTargetValue, set<CWalletTx*>& setCoinsRet)
 
     CRITICAL_BLOCK(cs_mapWallet)
     {
-        for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (CHashMap<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
         {
             CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsFinal() || pcoin->fSpent)
@@ -2565,6 +3265,7 @@ bool CreateTransaction(CScript scriptPubKey, int64 nValue, CWalletTx& wtxNew, in
             {
                 wtxNew.vin.clear();
                 wtxNew.vout.clear();
+                wtxNew.SetModified();
                 if (nValue < 0)
                     return false;
                 int64 nValueOut = nValue;
@@ -2609,11 +3310,15 @@ bool CreateTransaction(CScript scriptPubKey, int64 nValue, CWalletTx& wtxNew, in
                             wtxNew.vin.push_back(CTxIn(pcoin->GetHash(), nOut));
 
                 // Sign
-                int nIn = 0;
+                vector<const CTransaction*> vpFrom;
                 foreach(CWalletTx* pcoin, setCoins)
                     for (int nOut = 0; nOut < pcoin->vout.size(); nOut++)
                         if (pcoin->vout[nOut].IsMine())
-                            SignSignature(*pcoin, wtxNew, nIn++);
+                            vpFrom.push_back(pcoin);
+                int64 nSignStart = GetTimeMicros();
+                if (!SignSignatures(vpFrom, wtxNew))
+                    return false;
+                printf("CreateTransaction() : signed %d inputs in %.1fms\n", vpFrom.size(), (GetTimeMicros() - nSignStart) * 0.001);
 
                 // Check that enough fee is included
                 if (nFee < wtxNew.GetMinFee(true))
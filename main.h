@@ -27,7 +27,7 @@ static const CBigNum bnProofOfWorkLimit(~uint256(0) >> 32);
 
 
 extern CCriticalSection cs_main;
-extern map<uint256, CBlockIndex*> mapBlockIndex;
+extern CHashMap<uint256, CBlockIndex*> mapBlockIndex;
 extern const uint256 hashGenesisBlock;
 extern CBlockIndex* pindexGenesisBlock;
 extern int nBestHeight;
@@ -39,6 +39,11 @@ extern int nDropMessagesTest;
 
 // Settings
 extern int fGenerateBitcoins;
+extern int nMinerThreads;
+extern int nMinerStatsInterval;
+extern unsigned int nSigCacheSize;
+extern unsigned int nKeyCacheSize;
+extern int nScriptCheckPar;
 extern int64 nTransactionFee;
 extern CAddress addrIncoming;
 
@@ -64,11 +69,17 @@ bool AddToWallet(const CWalletTx& wtxIn);
 void ReacceptWalletTransactions();
 // 是将钱包（Wallet）中的交易广播到比特币网络中
 void RelayWalletTransactions();
+bool RelayMemoryTx(const CInv& inv);
 // 是从本地磁盘上的区块文件中加载和建立区块索引（block index）
 bool LoadBlockIndex(bool fAllowNew=true);
 // 打印当前节点内存中的区块链（Blockchain）结构
 void PrintBlockTree();
-bool BitcoinMiner();
+void AbandonMinerWork(bool fNewTip);
+void NotifyMinerTransaction(const uint256& hash, bool fAdded);
+bool GetMinerTemplate(CBlock& block, vector<uint256>& vMerkleBranch, CBlockIndex*& pindexPrev, unsigned int& nBits, int64& nFees, unsigned int& nTransactionsUpdatedLast, int64& nTemplateTime);
+bool BitcoinMiner(unsigned int nThread=0, unsigned int nThreads=1);
+bool ProcessBlock(CNode* pfrom, CBlock* pblock);
+void GetTransactionHashes(const vector<CTransaction>& vtx, uint256* phashRet);
 bool ProcessMessages(CNode* pfrom);
 // 处理来自比特币网络的消息
 bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv);
@@ -149,11 +160,11 @@ class CInPoint
 {
 public:
 // 上一笔交易输出的位置信息，包括上一笔交易的哈希值和输出索引
-    CTransaction* ptx;
+    const CTransaction* ptx;
     unsigned int n;
 
     CInPoint() { SetNull(); }
-    CInPoint(CTransaction* ptxIn, unsigned int nIn) { ptx = ptxIn; n = nIn; }
+    CInPoint(const CTransaction* ptxIn, unsigned int nIn) { ptx = ptxIn; n = nIn; }
     void SetNull() { ptx = NULL; n = -1; }
     bool IsNull() const { return (ptx == NULL && n == -1); }
 };
@@ -191,6 +202,11 @@ public:
         return !(a == b);
     }
 
+    friend unsigned int SaltedHash(const COutPoint& a, unsigned int nSalt)
+    {
+        return SaltedHash(a.hash, nSalt + a.n * 0x9e3779b9);
+    }
+
     string ToString() const
     {
         return strprintf("COutPoint(%s, %d)", hash.ToString().substr(0,6).c_str(), n);
@@ -395,6 +411,11 @@ public:
     // 表示交易锁定时间
     int nLockTime;
 
+    // memory only, see SetModified
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+    mutable unsigned int nSizeCached;
+
 
     CTransaction()
     {
@@ -403,11 +424,23 @@ public:
 
     IMPLEMENT_SERIALIZE
     (
-        READWRITE(this->nVersion);
-        nVersion = this->nVersion;
-        READWRITE(vin);
-        READWRITE(vout);
-        READWRITE(nLockTime);
+        // The size doesn't depend on nType, so one cached value does for all
+        if (fGetSize && nSizeCached)
+        {
+            nSerSize = nSizeCached;
+        }
+        else
+        {
+            READWRITE(this->nVersion);
+            nVersion = this->nVersion;
+            READWRITE(vin);
+            READWRITE(vout);
+            READWRITE(nLockTime);
+            if (fGetSize)
+                nSizeCached = nSerSize;
+        }
+        if (fRead)
+            const_cast<CTransaction*>(this)->SetModified();
     )
 
     void SetNull()
@@ -416,6 +449,17 @@ public:
         vin.clear();
         vout.clear();
         nLockTime = 0;
+        SetModified();
+    }
+
+    // The hash and serialized size are worked out the first time they're
+    // asked for and kept.  Reading the transaction from a stream resets them,
+    // anything that changes vin, vout or nLockTime after the transaction may
+    // have been hashed or measured has to call this.
+    void SetModified()
+    {
+        fHashCached = false;
+        nSizeCached = 0;
     }
 
     bool IsNull() const
@@ -425,7 +469,12 @@ public:
 
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        if (!fHashCached)
+        {
+            hashCached = SerializeHash(*this);
+            fHashCached = true;
+        }
+        return hashCached;
     }
 
     // 于判断一笔交易是否已经达到最终状态
@@ -628,16 +677,18 @@ public:
     // 并支持后续的处理和管理操作。
     bool DisconnectInputs(CTxDB& txdb);
     // 用于连接一笔交易输入与其所引用的上一笔交易输出
-    bool ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPool, CDiskTxPos posThisTx, int nHeight, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee=0);
+    bool ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPool, CDiskTxPos posThisTx, int nHeight, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee=0,
+                       vector<CScriptCheck>* pvChecks=NULL) const;
     bool ClientConnectInputs();
 
     // 用于接受一笔新的比特币交易并将其添加到本地节点的交易池中
-    bool AcceptTransaction(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
+    // pvMsg is the message it came in, the pool takes its buffer if it's accepted
+    bool AcceptTransaction(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL, CDataStream* pvMsg=NULL);
 
-    bool AcceptTransaction(bool fCheckInputs=true, bool* pfMissingInputs=NULL)
+    bool AcceptTransaction(bool fCheckInputs=true, bool* pfMissingInputs=NULL, CDataStream* pvMsg=NULL)
     {
         CTxDB txdb("r");
-        return AcceptTransaction(txdb, fCheckInputs, pfMissingInputs);
+        return AcceptTransaction(txdb, fCheckInputs, pfMissingInputs, pvMsg);
     }
 
 protected:
@@ -646,13 +697,35 @@ protected:
     // 并需要对这些交易进行验证和处理后再加入本地交易池。
     // AddToMemoryPool函数可以帮助快速将新的交易添加到内存池中，
     // 并进行相应的验证和处理操作，以支持后续的交易确认、区块生成等功能。
-    bool AddToMemoryPool();
+    bool AddToMemoryPool(CDataStream* pvMsg=NULL);
 public:
     bool RemoveFromMemoryPool();
 };
 
 
 
+//
+// A memory pool transaction.  Nothing changes it once it's in the pool, so
+// the pool, the relay map and the miner's template share one copy instead of
+// each keeping their own.  A CWalletTx and a block's vtx still hold copies of
+// their own.  The serialized bytes it arrived as are taken over from the
+// message and kept with it for relaying.  The hash and size are worked out
+// up front so threads never write the caches of a shared transaction.
+//
+class CSharedTx
+{
+public:
+    CTransaction tx;
+    uint256 hash;
+    boost::shared_ptr<const CDataStream> pvMsg;
+
+    CSharedTx(const CTransaction& txIn, CDataStream* pvMsgIn=NULL);
+};
+
+typedef boost::shared_ptr<const CSharedTx> CTransactionRef;
+
+
+
 
 
 //
@@ -993,17 +1066,21 @@ public:
     uint256 BuildMerkleTree() const
     {
         vMerkleTree.clear();
-        foreach(const CTransaction& tx, vtx)
-            vMerkleTree.push_back(tx.GetHash());
+        vMerkleTree.resize(vtx.size());
+        if (!vtx.empty())
+            GetTransactionHashes(vtx, &vMerkleTree[0]);
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
-            {
-                int i2 = min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
-            }
+            // Sibling pairs sit next to each other, so a whole level is one
+            // run of 64-byte messages for the multi-buffer hash.  An odd last
+            // entry is paired with itself.
+            int nPairs = nSize / 2;
+            vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+            CryptoPP::SHA256_DoubleHash64((unsigned char*)&vMerkleTree[j + nSize], (unsigned char*)&vMerkleTree[j], nPairs);
+            if (nSize & 1)
+                vMerkleTree[j + nSize + nPairs] = Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                                       BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]));
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -1424,7 +1501,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1458,7 +1535,7 @@ public:
         // Find the first block the caller has in the main chain
         foreach(const uint256& hash, vHave)
         {
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1476,7 +1553,7 @@ public:
         // Find the first block the caller has in the main chain
         foreach(const uint256& hash, vHave)
         {
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1507,8 +1584,8 @@ public:
 
 
 
-extern map<uint256, CTransaction> mapTransactions;
-extern map<uint256, CWalletTx> mapWallet;
+extern CHashMap<uint256, CTransactionRef> mapTransactions;
+extern CHashMap<uint256, CWalletTx> mapWallet;
 // 指示钱包状态已发生更改或更新
 extern vector<pair<uint256, bool> > vWalletUpdated;
 // 用于存储钱包地址和相关信息之间的映射关系
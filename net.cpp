@@ -25,11 +25,12 @@ CNode nodeLocalHost(INVALID_SOCKET, CAddress("127.0.0.1", nLocalServices));
 CNode* pnodeLocalHost = &nodeLocalHost;
 bool fShutdown = false;
 array<bool, 10> vfThreadRunning;
+LONG nMinerThreadsRunning = 0;
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
 map<vector<unsigned char>, CAddress> mapAddresses;
 CCriticalSection cs_mapAddresses;
-map<CInv, CDataStream> mapRelay;
+CHashMap<CInv, boost::shared_ptr<const CDataStream> > mapRelay;
 deque<pair<int64, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 map<CInv, int64> mapAlreadyAskedFor;
@@ -433,6 +434,67 @@ void CNode::Disconnect()
             CancelSubscribe(nChannel);
 }
 
+void CNode::ReceiveBytes(const char* pch, unsigned int nBytes)
+{
+    //
+    // Message format
+    //  (4) message start
+    //  (12) command
+    //  (4) size
+    //  (x) data
+    //
+
+    while (nBytes > 0)
+    {
+        // Payload of the message being received
+        if (!vRecvMsg.empty() && !vRecvMsg.back().Complete())
+        {
+            CNetMessage& msg = vRecvMsg.back();
+            unsigned int n = min(nBytes, msg.hdr.nMessageSize - msg.nDataPos);
+            msg.vRecv.write(pch, n);
+            msg.nDataPos += n;
+            pch += n;
+            nBytes -= n;
+            continue;
+        }
+
+        // Collect a header's worth
+        unsigned int n = min(nBytes, (unsigned int)(sizeof(CMessageHeader) - vRecv.size()));
+        vRecv.write(pch, n);
+        pch += n;
+        nBytes -= n;
+        if (vRecv.size() < sizeof(CMessageHeader))
+            break;
+
+        // Scan for message start, keeping any partial match at the end
+        CDataStream::iterator pstart = search(vRecv.begin(), vRecv.end(), BEGIN(pchMessageStart), END(pchMessageStart));
+        if (pstart != vRecv.begin())
+        {
+            if (pstart == vRecv.end())
+                pstart = vRecv.end() - (sizeof(pchMessageStart) - 1);
+            printf("\n\nPROCESSMESSAGE SKIPPED %d BYTES\n\n", pstart - vRecv.begin());
+            vRecv.erase(vRecv.begin(), pstart);
+            vRecv.Compact();
+            continue;
+        }
+
+        // Read header
+        vRecvMsg.push_back(CNetMessage(vRecv.nType, vRecv.nVersion));
+        CNetMessage& msg = vRecvMsg.back();
+        vRecv >> msg.hdr;
+        if (!msg.hdr.IsValid())
+        {
+            printf("\n\nPROCESSMESSAGE: ERRORS IN HEADER %s\n\n\n", msg.hdr.GetCommand().c_str());
+            vRecvMsg.pop_back();
+            continue;
+        }
+
+        // The size is only a claim until the data shows up, so don't
+        // reserve much more than a block's worth up front
+        msg.vRecv.reserve(min(msg.hdr.nMessageSize, (unsigned int)0x100000));
+    }
+}
+
 
 
 
@@ -481,7 +543,7 @@ void ThreadSocketHandler2(void* parg)
             vector<CNode*> vNodesCopy = vNodes;
             foreach(CNode* pnode, vNodesCopy)
             {
-                if (pnode->ReadyToDisconnect() && pnode->vRecv.empty() && pnode->vSend.empty())
+                if (pnode->ReadyToDisconnect() && !pnode->RecvMessageReady() && pnode->vSendMsg.empty())
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
@@ -544,7 +606,7 @@ void ThreadSocketHandler2(void* parg)
                 FD_SET(pnode->hSocket, &fdsetRecv);
                 hSocketMax = max(hSocketMax, pnode->hSocket);
                 TRY_CRITICAL_BLOCK(pnode->cs_vSend)
-                    if (!pnode->vSend.empty())
+                    if (!pnode->vSendMsg.empty())
                         FD_SET(pnode->hSocket, &fdsetSend);
             }
         }
@@ -618,14 +680,17 @@ void ThreadSocketHandler2(void* parg)
             {
                 TRY_CRITICAL_BLOCK(pnode->cs_vRecv)
                 {
-                    CDataStream& vRecv = pnode->vRecv;
-                    unsigned int nPos = vRecv.size();
-
-                    // typical socket buffer is 8K-64K
-                    const unsigned int nBufSize = 0x10000;
-                    vRecv.resize(nPos + nBufSize);
-                    int nBytes = recv(hSocket, &vRecv[nPos], nBufSize, 0);
-                    vRecv.resize(nPos + max(nBytes, 0));
+                    // typical socket buffer is 8K-64K.  The rest of a payload
+                    // that's already started goes straight into its message,
+                    // anything else is framed out of pchBuf.
+                    char pchBuf[0x10000];
+                    unsigned int nSize = sizeof(pchBuf);
+                    char* pchPayload = pnode->GetRecvPayload(nSize);
+                    int nBytes = recv(hSocket, (pchPayload ? pchPayload : pchBuf), nSize, 0);
+                    if (pchPayload)
+                        pnode->RecvPayloadDone(max(nBytes, 0));
+                    else if (nBytes > 0)
+                        pnode->ReceiveBytes(pchBuf, nBytes);
                     if (nBytes == 0)
                     {
                         // socket closed gracefully
@@ -654,24 +719,36 @@ void ThreadSocketHandler2(void* parg)
             {
                 TRY_CRITICAL_BLOCK(pnode->cs_vSend)
                 {
-                    CDataStream& vSend = pnode->vSend;
-                    if (!vSend.empty())
+                    deque<CDataStream>& vSendMsg = pnode->vSendMsg;
+                    if (!vSendMsg.empty())
                     {
-                        int nBytes = send(hSocket, &vSend[0], vSend.size(), 0);
+                        // Gather the first few queued messages into one send
+                        WSABUF pbuf[16];
+                        DWORD nBufs = 0;
+                        unsigned int nOffset = pnode->nSendOffset;
+                        for (deque<CDataStream>::iterator it = vSendMsg.begin(); it != vSendMsg.end() && nBufs < 16; ++it)
+                        {
+                            pbuf[nBufs].buf = &(*it)[nOffset];
+                            pbuf[nBufs].len = (*it).size() - nOffset;
+                            nBufs++;
+                            nOffset = 0;
+                        }
+                        DWORD nSent = 0;
+                        int nBytes = (WSASend(hSocket, pbuf, nBufs, &nSent, 0, NULL, NULL) == SOCKET_ERROR ? -1 : nSent);
                         if (nBytes > 0)
                         {
-                            vSend.erase(vSend.begin(), vSend.begin() + nBytes);
+                            pnode->SendQueueAdvance(nBytes);
                         }
                         else if (nBytes == 0)
                         {
                             if (pnode->ReadyToDisconnect())
-                                pnode->vSend.clear();
+                                pnode->SendQueueClear();
                         }
                         else
                         {
-                            printf("send error %d\n", nBytes);
+                            printf("send error %d\n", WSAGetLastError());
                             if (pnode->ReadyToDisconnect())
-                                pnode->vSend.clear();
+                                pnode->SendQueueClear();
                         }
                     }
                 }
@@ -921,18 +998,36 @@ void ThreadMessageHandler2(void* parg)
 
 
 
-//// todo: start one thread per processor, use getenv("NUMBER_OF_PROCESSORS")
 void ThreadBitcoinMiner(void* parg)
 {
+    // The thread started with NULL starts the rest, one per processor
+    // unless /minerthreads says otherwise
+    unsigned int nThread = 0;
+    unsigned int nThreads = (nMinerThreads > 0 ? nMinerThreads : GetNumCores());
+    if (parg)
+    {
+        nThread = ((pair<unsigned int, unsigned int>*)parg)->first;
+        nThreads = ((pair<unsigned int, unsigned int>*)parg)->second;
+        delete (pair<unsigned int, unsigned int>*)parg;
+    }
+    else
+    {
+        for (unsigned int i = 1; i < nThreads; i++)
+            if (_beginthread(ThreadBitcoinMiner, 0, new pair<unsigned int, unsigned int>(i, nThreads)) == -1)
+                printf("Error: _beginthread(ThreadBitcoinMiner) failed\n");
+    }
+
+    InterlockedIncrement(&nMinerThreadsRunning);
     vfThreadRunning[3] = true;
     CheckForShutdown(3);
     try
     {
-        bool fRet = BitcoinMiner();
+        bool fRet = BitcoinMiner(nThread, nThreads);
         printf("BitcoinMiner returned %s\n\n\n", fRet ? "true" : "false");
     }
     CATCH_PRINT_EXCEPTION("BitcoinMiner()")
-    vfThreadRunning[3] = false;
+    if (InterlockedDecrement(&nMinerThreadsRunning) <= 0)
+        vfThreadRunning[3] = false;
 }
 
 
@@ -1067,8 +1162,9 @@ bool StopNode()
     printf("StopNode()\n");
     fShutdown = true;
     nTransactionsUpdated++;
+    AbandonMinerWork(true);
     int64 nStart = GetTime();
-    while (vfThreadRunning[0] || vfThreadRunning[2] || vfThreadRunning[3])
+    while (vfThreadRunning[0] || vfThreadRunning[2] || vfThreadRunning[3] || vfThreadRunning[4] || vfThreadRunning[5])
     {
         if (GetTime() - nStart > 15)
             break;
@@ -1078,6 +1174,8 @@ bool StopNode()
     if (vfThreadRunning[1]) printf("ThreadOpenConnections still running\n");
     if (vfThreadRunning[2]) printf("ThreadMessageHandler still running\n");
     if (vfThreadRunning[3]) printf("ThreadBitcoinMiner still running\n");
+    if (vfThreadRunning[4]) printf("ThreadWorkServer still running\n");
+    if (vfThreadRunning[5]) printf("ThreadScriptCheck still running\n");
     while (vfThreadRunning[2])
         Sleep(20);
     Sleep(50);
@@ -1091,7 +1189,13 @@ void CheckForShutdown(int n)
 {
     if (fShutdown)
     {
-        if (n != -1)
+        if (n == 3)
+        {
+            // Miner threads share a slot, it's clear when the last one exits
+            if (InterlockedDecrement(&nMinerThreadsRunning) <= 0)
+                vfThreadRunning[3] = false;
+        }
+        else if (n != -1)
             vfThreadRunning[n] = false;
         if (n == 0)
             foreach(CNode* pnode, vNodes)
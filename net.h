@@ -124,6 +124,31 @@ public:
 
 
 
+//
+// Message received from a peer.  The header is parsed once and the payload
+// is read into vRecv as it arrives, so ProcessMessage gets it where it landed
+// without being searched or copied again.
+//
+class CNetMessage
+{
+public:
+    CMessageHeader hdr;
+    CDataStream vRecv;
+    unsigned int nDataPos;
+
+    CNetMessage(int nTypeIn, int nVersionIn) : vRecv(nTypeIn, nVersionIn)
+    {
+        nDataPos = 0;
+    }
+
+    bool Complete() const
+    {
+        return (nDataPos == hdr.nMessageSize);
+    }
+};
+
+
+
 
 
 
@@ -362,6 +387,16 @@ public:
         return (a.type < b.type || (a.type == b.type && a.hash < b.hash));
     }
 
+    friend inline bool operator==(const CInv& a, const CInv& b)
+    {
+        return (a.type == b.type && a.hash == b.hash);
+    }
+
+    friend inline unsigned int SaltedHash(const CInv& a, unsigned int nSalt)
+    {
+        return SaltedHash(a.hash, nSalt + a.type * 0x9e3779b9);
+    }
+
     bool IsKnownType() const
     {
         return (type >= 1 && type < ARRAYLEN(ppszTypeName));
@@ -421,7 +456,7 @@ extern vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
 extern map<vector<unsigned char>, CAddress> mapAddresses;
 extern CCriticalSection cs_mapAddresses;
-extern map<CInv, CDataStream> mapRelay;
+extern CHashMap<CInv, boost::shared_ptr<const CDataStream> > mapRelay;
 extern deque<pair<int64, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern map<CInv, int64> mapAlreadyAskedFor;
@@ -442,6 +477,19 @@ public:
     CCriticalSection cs_vSend;
     CCriticalSection cs_vRecv;
     unsigned int nPushPos;
+
+    // Finished messages waiting for the socket.  vSend only holds the one
+    // being built, EndMessage moves it here whole.  The socket thread sends
+    // from several at once and frees each when it's done with it instead of
+    // shifting the rest of the backlog down.
+    deque<CDataStream> vSendMsg;
+    unsigned int nSendOffset;
+
+    // Messages coming in.  vRecv only collects header bytes and keeps the
+    // receive type and version, each good header starts a CNetMessage here
+    // that its payload goes into.  Finished messages are at the front, one
+    // still arriving may be at the back.
+    deque<CNetMessage> vRecvMsg;
     CAddress addr;
     int nVersion;
     bool fClient;
@@ -477,6 +525,7 @@ public:
         vSend.SetType(SER_NETWORK);
         vRecv.SetType(SER_NETWORK);
         nPushPos = -1;
+        nSendOffset = 0;
         addr = addrIn;
         nVersion = 0;
         fClient = false; // set by version message
@@ -604,10 +653,63 @@ public:
         //    printf("%02x ", vSend[i] & 0xff);
         printf("\n");
 
+        // Queue the finished message, swapping the buffer rather than copying
+        vSendMsg.push_back(CDataStream(vSend.nType, vSend.nVersion));
+        vSendMsg.back().swap(vSend);
+
         nPushPos = -1;
         LeaveCriticalSection(&cs_vSend);
     }
 
+    // Drop the first nBytes of the send queue after the socket has taken them
+    void SendQueueAdvance(unsigned int nBytes)
+    {
+        while (nBytes > 0 && !vSendMsg.empty())
+        {
+            unsigned int nLeft = vSendMsg.front().size() - nSendOffset;
+            if (nBytes < nLeft)
+            {
+                nSendOffset += nBytes;
+                return;
+            }
+            nBytes -= nLeft;
+            nSendOffset = 0;
+            vSendMsg.pop_front();
+        }
+    }
+
+    void SendQueueClear()
+    {
+        vSendMsg.clear();
+        nSendOffset = 0;
+    }
+
+    // Room for up to nSize more bytes of a payload that's already started,
+    // for the socket to recv into directly.  NULL between messages.
+    char* GetRecvPayload(unsigned int& nSize)
+    {
+        if (vRecvMsg.empty() || vRecvMsg.back().Complete())
+            return NULL;
+        CNetMessage& msg = vRecvMsg.back();
+        nSize = min(nSize, msg.hdr.nMessageSize - msg.nDataPos);
+        msg.vRecv.resize(msg.nDataPos + nSize);
+        return &msg.vRecv[msg.nDataPos];
+    }
+
+    void RecvPayloadDone(unsigned int nBytes)
+    {
+        CNetMessage& msg = vRecvMsg.back();
+        msg.nDataPos += nBytes;
+        msg.vRecv.resize(msg.nDataPos);
+    }
+
+    bool RecvMessageReady()
+    {
+        return (!vRecvMsg.empty() && vRecvMsg.front().Complete());
+    }
+
+    void ReceiveBytes(const char* pch, unsigned int nBytes);
+
     void EndMessageAbortIfEmpty()
     {
         if (nPushPos == -1)
@@ -771,17 +873,9 @@ inline void RelayInventory(const CInv& inv)
             pnode->PushInventory(inv);
 }
 
-template<typename T>
-void RelayMessage(const CInv& inv, const T& a)
-{
-    CDataStream ss(SER_NETWORK);
-    ss.reserve(10000);
-    ss << a;
-    RelayMessage(inv, ss);
-}
-
-template<>
-inline void RelayMessage<>(const CInv& inv, const CDataStream& ss)
+// The relay map holds messages by reference, so a memory pool transaction's
+// bytes are shared with the pool rather than copied
+inline void RelayMessage(const CInv& inv, const boost::shared_ptr<const CDataStream>& pss)
 {
     CRITICAL_BLOCK(cs_mapRelay)
     {
@@ -793,13 +887,28 @@ inline void RelayMessage<>(const CInv& inv, const CDataStream& ss)
         }
 
         // Save original serialized message so newer versions are preserved
-        mapRelay[inv] = ss;
+        mapRelay[inv] = pss;
         vRelayExpiration.push_back(make_pair(GetTime() + 15 * 60, inv));
     }
 
     RelayInventory(inv);
 }
 
+template<typename T>
+void RelayMessage(const CInv& inv, const T& a)
+{
+    CDataStream ss(SER_NETWORK);
+    ss.reserve(10000);
+    ss << a;
+    RelayMessage(inv, ss);
+}
+
+template<>
+inline void RelayMessage<>(const CInv& inv, const CDataStream& ss)
+{
+    RelayMessage(inv, boost::shared_ptr<const CDataStream>(new CDataStream(ss)));
+}
+
 
 
 
@@ -4,7 +4,8 @@
 
 #include "headers.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+              const CSignatureHashContext* psighash=NULL);
 
 
 
@@ -18,15 +19,6 @@ static const CBigNum bnFalse(0);
 static const CBigNum bnTrue(1);
 
 
-// 可能: 指示迭代器是否指向脚本中的非零字节。
-// 换句话说，它检查迭代器当前指向的值是否为非零值，如果是，
-// 则返回true，否则返回false。在比特币的代码库中，
-// CastToBool函数被用于评估脚本中的条件表达式。
-bool CastToBool(const valtype& vch)
-{
-    return (CBigNum(vch) != bnZero);
-}
-
 void MakeSameSize(valtype& vch1, valtype& vch2)
 {
     // Lengthen the shorter one
@@ -46,9 +38,8 @@ void MakeSameSize(valtype& vch1, valtype& vch2)
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
 
 bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
-                vector<vector<unsigned char> >* pvStackRet)
+                vector<vector<unsigned char> >* pvStackRet, const CSignatureHashContext* psighash)
 {
-    CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
@@ -98,8 +89,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
             case OP_16:
             {
                 // ( -- value)
-                CBigNum bn((int)opcode - (int)(OP_1 - 1));
-                stack.push_back(bn.getvch());
+                stack.push_back(ScriptNumVch((int)opcode - (int)(OP_1 - 1)));
             }
             break;
 
@@ -112,8 +102,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
 
             case OP_VER:
             {
-                CBigNum bn(VERSION);
-                stack.push_back(bn.getvch());
+                stack.push_back(ScriptNumVch(VERSION));
             }
             break;
 
@@ -129,8 +118,9 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                     if (stack.size() < 1)
                         return false;
                     valtype& vch = stacktop(-1);
+                    int64 n;
                     if (opcode == OP_VERIF || opcode == OP_VERNOTIF)
-                        fValue = (CBigNum(VERSION) >= CBigNum(vch));
+                        fValue = (GetScriptNum(vch, n) ? VERSION >= n : CBigNum(VERSION) >= CBigNum(vch));
                     else
                         fValue = CastToBool(vch);
                     if (opcode == OP_NOTIF || opcode == OP_VERNOTIF)
@@ -282,8 +272,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
             case OP_DEPTH:
             {
                 // -- stacksize
-                CBigNum bn(stack.size());
-                stack.push_back(bn.getvch());
+                stack.push_back(ScriptNumVch(stack.size()));
             }
             break;
 
@@ -332,7 +321,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 // (xn ... x2 x1 x0 n - ... x2 x1 x0 xn)
                 if (stack.size() < 2)
                     return false;
-                int n = CBigNum(stacktop(-1)).getint();
+                int n = ScriptNumToInt(stacktop(-1));
                 stack.pop_back();
                 if (n < 0 || n >= stack.size())
                     return false;
@@ -396,8 +385,8 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 if (stack.size() < 3)
                     return false;
                 valtype& vch = stacktop(-3);
-                int nBegin = CBigNum(stacktop(-2)).getint();
-                int nEnd = nBegin + CBigNum(stacktop(-1)).getint();
+                int nBegin = ScriptNumToInt(stacktop(-2));
+                int nEnd = nBegin + ScriptNumToInt(stacktop(-1));
                 if (nBegin < 0 || nEnd < nBegin)
                     return false;
                 if (nBegin > vch.size())
@@ -418,7 +407,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 if (stack.size() < 2)
                     return false;
                 valtype& vch = stacktop(-2);
-                int nSize = CBigNum(stacktop(-1)).getint();
+                int nSize = ScriptNumToInt(stacktop(-1));
                 if (nSize < 0)
                     return false;
                 if (nSize > vch.size())
@@ -436,8 +425,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 // (in -- in size)
                 if (stack.size() < 1)
                     return false;
-                CBigNum bn(stacktop(-1).size());
-                stack.push_back(bn.getvch());
+                stack.push_back(ScriptNumVch(stacktop(-1).size()));
             }
             break;
 
@@ -529,6 +517,13 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 // (in -- out)
                 if (stack.size() < 1)
                     return false;
+                int64 n1, n;
+                if (GetScriptNum(stacktop(-1), n1) && EvalScriptNumUnary(opcode, n1, n))
+                {
+                    stack.pop_back();
+                    stack.push_back(ScriptNumVch(n));
+                    break;
+                }
                 CBigNum bn(stacktop(-1));
                 switch (opcode)
                 {
@@ -568,61 +563,72 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 // (x1 x2 -- out)
                 if (stack.size() < 2)
                     return false;
-                CBigNum bn1(stacktop(-2));
-                CBigNum bn2(stacktop(-1));
-                CBigNum bn;
-                switch (opcode)
+                int64 n1, n2, n;
+                if (GetScriptNum(stacktop(-2), n1) && GetScriptNum(stacktop(-1), n2) && EvalScriptNum(opcode, n1, n2, n))
                 {
-                case OP_ADD:
-                    bn = bn1 + bn2;
-                    break;
-
-                case OP_SUB:
-                    bn = bn1 - bn2;
-                    break;
-
-                case OP_MUL:
-                    if (!BN_mul(&bn, &bn1, &bn2, pctx))
-                        return false;
-                    break;
-
-                case OP_DIV:
-                    if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
-                        return false;
-                    break;
-
-                case OP_MOD:
-                    if (!BN_mod(&bn, &bn1, &bn2, pctx))
-                        return false;
-                    break;
-
-                case OP_LSHIFT:
-                    if (bn2 < bnZero)
-                        return false;
-                    bn = bn1 << bn2.getulong();
-                    break;
-
-                case OP_RSHIFT:
-                    if (bn2 < bnZero)
-                        return false;
-                    bn = bn1 >> bn2.getulong();
-                    break;
-
-                case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
-                case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
-                case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
-                case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
-                case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
-                case OP_LESSTHAN:            bn = (bn1 < bn2); break;
-                case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
-                case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
-                case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
-                case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
-                case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
+                    stack.pop_back();
+                    stack.pop_back();
+                    stack.push_back(ScriptNumVch(n));
+                }
+                else
+                {
+                    CAutoBN_CTX pctx;
+                    CBigNum bn1(stacktop(-2));
+                    CBigNum bn2(stacktop(-1));
+                    CBigNum bn;
+                    switch (opcode)
+                    {
+                    case OP_ADD:
+                        bn = bn1 + bn2;
+                        break;
+
+                    case OP_SUB:
+                        bn = bn1 - bn2;
+                        break;
+
+                    case OP_MUL:
+                        if (!BN_mul(&bn, &bn1, &bn2, pctx))
+                            return false;
+                        break;
+
+                    case OP_DIV:
+                        if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
+                            return false;
+                        break;
+
+                    case OP_MOD:
+                        if (!BN_mod(&bn, &bn1, &bn2, pctx))
+                            return false;
+                        break;
+
+                    case OP_LSHIFT:
+                        if (bn2 < bnZero)
+                            return false;
+                        bn = bn1 << bn2.getulong();
+                        break;
+
+                    case OP_RSHIFT:
+                        if (bn2 < bnZero)
+                            return false;
+                        bn = bn1 >> bn2.getulong();
+                        break;
+
+                    case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
+                    case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
+                    case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
+                    case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
+                    case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
+                    case OP_LESSTHAN:            bn = (bn1 < bn2); break;
+                    case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
+                    case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
+                    case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
+                    case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
+                    case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
+                    }
+                    stack.pop_back();
+                    stack.pop_back();
+                    stack.push_back(bn.getvch());
                 }
-                stack.pop_back();
-                stack.pop_back();
-                stack.push_back(bn.getvch());
 
                 if (opcode == OP_NUMEQUALVERIFY)
                 {
@@ -639,10 +645,19 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 // (x min max -- out)
                 if (stack.size() < 3)
                     return false;
-                CBigNum bn1(stacktop(-3));
-                CBigNum bn2(stacktop(-2));
-                CBigNum bn3(stacktop(-1));
-                bool fValue = (bn2 <= bn1 && bn1 < bn3);
+                int64 n1, n2, n3;
+                bool fValue;
+                if (GetScriptNum(stacktop(-3), n1) && GetScriptNum(stacktop(-2), n2) && GetScriptNum(stacktop(-1), n3))
+                {
+                    fValue = (n2 <= n1 && n1 < n3);
+                }
+                else
+                {
+                    CBigNum bn1(stacktop(-3));
+                    CBigNum bn2(stacktop(-2));
+                    CBigNum bn3(stacktop(-1));
+                    fValue = (bn2 <= bn1 && bn1 < bn3);
+                }
                 stack.pop_back();
                 stack.pop_back();
                 stack.pop_back();
@@ -713,7 +728,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 // Drop the signature, since there's no way for a signature to sign itself
                 scriptCode.FindAndDelete(CScript(vchSig));
 
-                bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, psighash);
 
                 stack.pop_back();
                 stack.pop_back();
@@ -737,7 +752,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 if (stack.size() < i)
                     return false;
 
-                int nKeysCount = CBigNum(stacktop(-i)).getint();
+                int nKeysCount = ScriptNumToInt(stacktop(-i));
                 if (nKeysCount < 0)
                     return false;
                 int ikey = ++i;
@@ -745,7 +760,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                 if (stack.size() < i)
                     return false;
 
-                int nSigsCount = CBigNum(stacktop(-i)).getint();
+                int nSigsCount = ScriptNumToInt(stacktop(-i));
                 if (nSigsCount < 0 || nSigsCount > nKeysCount)
                     return false;
                 int isig = ++i;
@@ -770,7 +785,7 @@ bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nI
                     valtype& vchPubKey = stacktop(-ikey);
 
                     // Check signature
-                    if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType))
+                    if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, psighash))
                     {
                         isig++;
                         nSigsCount--;
@@ -875,22 +890,169 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     }
 
     // Serialize and hash
-    CDataStream ss(SER_GETHASH);
-    ss.reserve(10000);
+    CHashWriter ss(SER_GETHASH);
     ss << txTmp << nHashType;
-    return Hash(ss.begin(), ss.end());
+    return ss.GetHash();
 }
 
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType)
+void CSignatureHashContext::Init() const
 {
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-        return false;
+    if (fInit)
+        return;
+
+    // Serialize the way SignatureHash's txTmp would be with no scriptSigs,
+    // noting where each input and its scriptSig start
+    CDataStream ss(SER_GETHASH);
+    ss.reserve(4 + 9 + 41 * txTo.vin.size() + 10 + 34 * txTo.vout.size());
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+    vInputPos.reserve(txTo.vin.size());
+    vScriptPos.reserve(txTo.vin.size());
+    foreach(const CTxIn& txin, txTo.vin)
+    {
+        vInputPos.push_back(ss.size());
+        ss << txin.prevout;
+        vScriptPos.push_back(ss.size());
+        ss << CScript() << txin.nSequence;
+    }
+    ss << txTo.vout << txTo.nLockTime;
+    vchBlank.assign(ss.begin(), ss.end());
+
+    // Hash state at the start of each input
+    CHashWriter hasher(SER_GETHASH);
+    unsigned int nPos = 0;
+    vInputHasher.reserve(vInputPos.size());
+    foreach(unsigned int nInputPos, vInputPos)
+    {
+        hasher.write(&vchBlank[nPos], nInputPos - nPos);
+        nPos = nInputPos;
+        vInputHasher.push_back(hasher);
+    }
+    fInit = true;
+}
+
+uint256 CSignatureHashContext::SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const
+{
+    // The other hash types change more than the one scriptSig
+    if ((nHashType & 0x1f) == SIGHASH_NONE || (nHashType & 0x1f) == SIGHASH_SINGLE ||
+        (nHashType & SIGHASH_ANYONECANPAY) || nIn >= txTo.vin.size())
+        return ::SignatureHash(scriptCode, txTo, nIn, nHashType);
+
+    Init();
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    // Resume at this input's prevout, put the scriptCode in place of its
+    // empty scriptSig, which is just its one byte length, then the rest of
+    // the transaction as it was
+    unsigned int nPos = vScriptPos[nIn];
+    CHashWriter ss(vInputHasher[nIn]);
+    ss.write(&vchBlank[vInputPos[nIn]], nPos - vInputPos[nIn]);
+    ss << scriptCode;
+    ss.write(&vchBlank[nPos + 1], vchBlank.size() - (nPos + 1));
+    ss << nHashType;
+    return ss.GetHash();
+}
+
+
+//
+// Signatures that have already verified, so a transaction that was checked
+// when it went into the memory pool doesn't pay for ECDSA again when it
+// shows up in a block.  Only successes are kept, as a hash of the signature
+// hash, public key and signature.
+//
+static CCriticalSection cs_setSignatureCache;
+static set<uint256> setSignatureCache;
+
+static uint256 SignatureCacheEntry(const uint256& hash, const vector<unsigned char>& vchPubKey, const vector<unsigned char>& vchSig)
+{
+    return Hash(BEGIN(hash), END(hash), vchPubKey.begin(), vchPubKey.end(), vchSig.begin(), vchSig.end());
+}
+
+static bool IsInSignatureCache(const uint256& entry)
+{
+    CRITICAL_BLOCK(cs_setSignatureCache)
+        return setSignatureCache.count(entry) != 0;
+    return false;
+}
+
+static void AddToSignatureCache(const uint256& entry)
+{
+    CRITICAL_BLOCK(cs_setSignatureCache)
+    {
+        // Entries are hashes, so the one after the new entry is as good
+        // a random pick to evict as any
+        while (setSignatureCache.size() >= nSigCacheSize)
+        {
+            set<uint256>::iterator it = setSignatureCache.lower_bound(entry);
+            if (it == setSignatureCache.end())
+                it = setSignatureCache.begin();
+            setSignatureCache.erase(it);
+        }
+        setSignatureCache.insert(entry);
+    }
+}
+
+//
+// Parsed public keys, most recently used first.  A key is taken out of the
+// cache while it's being used and put back after, so verification threads
+// never share an EC_KEY.  Two threads wanting the same key at once just
+// parse it twice.
+//
+typedef list<pair<vector<unsigned char>, CKey*> > CPubKeyList;
+static CCriticalSection cs_mapPubKeyCache;
+static CPubKeyList listPubKeyCache;
+static map<vector<unsigned char>, CPubKeyList::iterator> mapPubKeyCache;
+
+static CKey* TakeCachedPubKey(const vector<unsigned char>& vchPubKey)
+{
+    CRITICAL_BLOCK(cs_mapPubKeyCache)
+    {
+        map<vector<unsigned char>, CPubKeyList::iterator>::iterator mi = mapPubKeyCache.find(vchPubKey);
+        if (mi != mapPubKeyCache.end())
+        {
+            CKey* pkey = (*mi).second->second;
+            listPubKeyCache.erase((*mi).second);
+            mapPubKeyCache.erase(mi);
+            return pkey;
+        }
+    }
+
+    CKey* pkey = new CKey();
+    if (!pkey->SetPubKey(vchPubKey))
+    {
+        delete pkey;
+        return NULL;
+    }
+    return pkey;
+}
+
+static void ReturnCachedPubKey(const vector<unsigned char>& vchPubKey, CKey* pkey)
+{
+    CRITICAL_BLOCK(cs_mapPubKeyCache)
+    {
+        if (mapPubKeyCache.count(vchPubKey))
+        {
+            delete pkey;
+            return;
+        }
+        listPubKeyCache.push_front(make_pair(vchPubKey, pkey));
+        mapPubKeyCache[vchPubKey] = listPubKeyCache.begin();
+        while (mapPubKeyCache.size() > nKeyCacheSize)
+        {
+            mapPubKeyCache.erase(listPubKeyCache.back().first);
+            delete listPubKeyCache.back().second;
+            listPubKeyCache.pop_back();
+        }
+    }
+}
 
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashContext* psighash)
+{
     // Hash type is one byte tacked on to the end of the signature
-    if (vchSig.empty())
+    if (vchSig.empty() || vchPubKey.empty())
         return false;
     if (nHashType == 0)
         nHashType = vchSig.back();
@@ -898,9 +1060,27 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
         return false;
     vchSig.pop_back();
 
-    if (key.Verify(SignatureHash(scriptCode, txTo, nIn, nHashType), vchSig))
+    uint256 hash = (psighash ? psighash->SignatureHash(scriptCode, nIn, nHashType)
+                             : SignatureHash(scriptCode, txTo, nIn, nHashType));
+
+    // Only verified signatures are cached, so a hit also means the public
+    // key was good
+    uint256 entry = SignatureCacheEntry(hash, vchPubKey, vchSig);
+    if (IsInSignatureCache(entry))
         return true;
 
+    CKey* pkey = TakeCachedPubKey(vchPubKey);
+    if (!pkey)
+        return false;
+    bool fValid = pkey->Verify(hash, vchSig);
+    ReturnCachedPubKey(vchPubKey, pkey);
+
+    if (fValid)
+    {
+        AddToSignatureCache(entry);
+        return true;
+    }
+
     return false;
 }
 
@@ -976,7 +1156,37 @@ bool Solver(const CScript& scriptPubKey, vector<pair<opcodetype, valtype> >& vSo
 }
 
 
-bool Solver(const CScript& scriptPubKey, uint256 hash, int nHashType, CScript& scriptSigRet)
+//
+// Generator precomputation for CBatchSigner.  EC_GROUP_dup shares the table
+// by reference, so every key moved onto this group uses the one copy.
+//
+static CCriticalSection cs_SigningGroup;
+static EC_GROUP* pSigningGroup = NULL;
+static bool fSigningGroupInit = false;
+
+const EC_GROUP* GetSigningGroup()
+{
+    CRITICAL_BLOCK(cs_SigningGroup)
+    {
+        if (!fSigningGroupInit)
+        {
+            fSigningGroupInit = true;
+            pSigningGroup = EC_GROUP_new_by_curve_name(NID_secp256k1);
+            if (pSigningGroup && !EC_GROUP_precompute_mult(pSigningGroup, NULL))
+            {
+                EC_GROUP_free(pSigningGroup);
+                pSigningGroup = NULL;
+            }
+            if (!pSigningGroup)
+                printf("GetSigningGroup() : generator precomputation failed\n");
+        }
+        return pSigningGroup;
+    }
+    return NULL;
+}
+
+
+bool Solver(const CScript& scriptPubKey, uint256 hash, int nHashType, CScript& scriptSigRet, CBatchSigner* psigner=NULL)
 {
     scriptSigRet.clear();
 
@@ -998,7 +1208,8 @@ bool Solver(const CScript& scriptPubKey, uint256 hash, int nHashType, CScript& s
                 if (hash != 0)
                 {
                     vector<unsigned char> vchSig;
-                    if (!CKey::Sign(mapKeys[vchPubKey], hash, vchSig))
+                    if (!(psigner ? psigner->Sign(vchPubKey, mapKeys[vchPubKey], hash, vchSig)
+                                  : CKey::Sign(mapKeys[vchPubKey], hash, vchSig)))
                         return false;
                     vchSig.push_back((unsigned char)nHashType);
                     scriptSigRet << vchSig;
@@ -1016,7 +1227,8 @@ bool Solver(const CScript& scriptPubKey, uint256 hash, int nHashType, CScript& s
                 if (hash != 0)
                 {
                     vector<unsigned char> vchSig;
-                    if (!CKey::Sign(mapKeys[vchPubKey], hash, vchSig))
+                    if (!(psigner ? psigner->Sign(vchPubKey, mapKeys[vchPubKey], hash, vchSig)
+                                  : CKey::Sign(mapKeys[vchPubKey], hash, vchSig)))
                         return false;
                     vchSig.push_back((unsigned char)nHashType);
                     scriptSigRet << vchSig << vchPubKey;
@@ -1091,7 +1303,8 @@ bool ExtractHash160(const CScript& scriptPubKey, uint160& hash160Ret)
 }
 
 
-bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType, CScript scriptPrereq)
+bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType, CScript scriptPrereq,
+                   const CSignatureHashContext* psighash)
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
@@ -1100,8 +1313,10 @@ bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(scriptPrereq + txout.scriptPubKey, txTo, nIn, nHashType);
+    uint256 hash = (psighash ? psighash->SignatureHash(scriptPrereq + txout.scriptPubKey, nIn, nHashType)
+                             : SignatureHash(scriptPrereq + txout.scriptPubKey, txTo, nIn, nHashType));
 
+    txTo.SetModified();
     if (!Solver(txout.scriptPubKey, hash, nHashType, txin.scriptSig))
         return false;
 
@@ -1109,14 +1324,47 @@ bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int
 
     // Test solution
     if (scriptPrereq.empty())
-        if (!EvalScript(txin.scriptSig + CScript(OP_CODESEPARATOR) + txout.scriptPubKey, txTo, nIn))
+        if (!EvalScript(txin.scriptSig + CScript(OP_CODESEPARATOR) + txout.scriptPubKey, txTo, nIn, 0, NULL, psighash))
             return false;
 
     return true;
 }
 
 
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType)
+bool SignSignatures(const vector<const CTransaction*>& vpFrom, CTransaction& txTo, int nHashType)
+{
+    assert(vpFrom.size() == txTo.vin.size());
+    CSignatureHashContext sighash(txTo);
+    sighash.Init();
+
+    // Signing stays on this thread, Solver holds cs_mapKeys while it signs,
+    // but each key is only parsed once for the whole transaction
+    CBatchSigner signer;
+    vector<CScriptCheck> vChecks;
+    vChecks.reserve(txTo.vin.size());
+    for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++)
+    {
+        CTxIn& txin = txTo.vin[nIn];
+        assert(txin.prevout.n < vpFrom[nIn]->vout.size());
+        const CTxOut& txout = vpFrom[nIn]->vout[txin.prevout.n];
+
+        uint256 hash = sighash.SignatureHash(txout.scriptPubKey, nIn, nHashType);
+        if (!Solver(txout.scriptPubKey, hash, nHashType, txin.scriptSig, &signer))
+            return false;
+
+        vChecks.push_back(CScriptCheck(txout.scriptPubKey, &txTo, nIn));
+        vChecks.back().psighash = &sighash;
+    }
+    txTo.SetModified();
+
+    // Test solutions, verifying costs more than signing so this part goes
+    // to the script verification threads
+    return RunScriptChecks(vChecks);
+}
+
+
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                     const CSignatureHashContext* psighash)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -1127,5 +1375,163 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    return EvalScript(txin.scriptSig + CScript(OP_CODESEPARATOR) + txout.scriptPubKey, txTo, nIn, nHashType);
+    return EvalScript(txin.scriptSig + CScript(OP_CODESEPARATOR) + txout.scriptPubKey, txTo, nIn, nHashType, NULL, psighash);
+}
+
+
+bool CScriptCheck::Check() const
+{
+    // A malformed script can throw, on another thread that has to count as
+    // a failed check rather than take the process down
+    try
+    {
+        const CTxIn& txin = ptxTo->vin[nIn];
+        return EvalScript(txin.scriptSig + CScript(OP_CODESEPARATOR) + scriptPubKey, *ptxTo, nIn, 0, NULL, psighash);
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+
+
+
+//
+// Script verification threads.  RunParallel publishes a batch of jobs, wakes
+// the threads and works through it along with them.  Jobs are claimed one at
+// a time under cs_ScriptCheck, so each should be at least an ECDSA verify's
+// worth of work.  After a failure the rest of the batch is dropped.
+//
+static CCriticalSection cs_RunScriptChecks;
+static CCriticalSection cs_ScriptCheck;
+static bool (*pfnScriptCheckJob)(void* parg, unsigned int n) = NULL;
+static void* pScriptCheckArg = NULL;
+static unsigned int nScriptCheckJobs = 0;
+static unsigned int nScriptCheckNext = 0;
+static unsigned int nScriptCheckTodo = 0;
+static bool fScriptCheckFailed = false;
+static HANDLE hScriptCheckWork = NULL;
+static HANDLE hScriptCheckDone = NULL;
+static int nScriptCheckThreads = -1;
+static LONG nScriptCheckThreadsRunning = 0;
+
+static void DoScriptChecks()
+{
+    loop
+    {
+        bool (*pfnJob)(void* parg, unsigned int n) = NULL;
+        void* parg = NULL;
+        unsigned int n = 0;
+        CRITICAL_BLOCK(cs_ScriptCheck)
+        {
+            if (pfnScriptCheckJob && fScriptCheckFailed && nScriptCheckNext < nScriptCheckJobs)
+            {
+                nScriptCheckTodo -= nScriptCheckJobs - nScriptCheckNext;
+                nScriptCheckNext = nScriptCheckJobs;
+                if (nScriptCheckTodo == 0)
+                    SetEvent(hScriptCheckDone);
+            }
+            if (pfnScriptCheckJob && nScriptCheckNext < nScriptCheckJobs)
+            {
+                pfnJob = pfnScriptCheckJob;
+                parg = pScriptCheckArg;
+                n = nScriptCheckNext++;
+            }
+            else
+                ResetEvent(hScriptCheckWork);
+        }
+        if (!pfnJob)
+            return;
+
+        bool fOK = pfnJob(parg, n);
+
+        CRITICAL_BLOCK(cs_ScriptCheck)
+        {
+            if (!fOK)
+                fScriptCheckFailed = true;
+            if (--nScriptCheckTodo == 0)
+                SetEvent(hScriptCheckDone);
+        }
+    }
+}
+
+void ThreadScriptCheck(void* parg)
+{
+    // The threads share a slot, it's clear when the last one exits
+    InterlockedIncrement(&nScriptCheckThreadsRunning);
+    vfThreadRunning[5] = true;
+    while (!fShutdown)
+    {
+        // Wake up now and then to notice shutdown.  A batch already started
+        // gets finished by the thread that ran it.
+        if (WaitForSingleObject(hScriptCheckWork, 1000) == WAIT_OBJECT_0)
+            DoScriptChecks();
+    }
+    if (InterlockedDecrement(&nScriptCheckThreadsRunning) <= 0)
+        vfThreadRunning[5] = false;
+}
+
+bool RunParallel(bool (*pfnJob)(void* parg, unsigned int n), void* parg, unsigned int nJobs)
+{
+    CRITICAL_BLOCK(cs_RunScriptChecks)
+    {
+        // Threads are started the first time there's something for them,
+        // /par=n sets the total including the calling thread
+        if (nScriptCheckThreads == -1)
+        {
+            int nThreads = (nScriptCheckPar > 0 ? nScriptCheckPar : GetNumCores());
+            nThreads = min(max(nThreads, 1), 64);
+            hScriptCheckWork = CreateEvent(NULL, TRUE, FALSE, NULL);
+            hScriptCheckDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+            nScriptCheckThreads = 0;
+            if (hScriptCheckWork && hScriptCheckDone)
+                for (int i = 1; i < nThreads; i++)
+                    if (_beginthread(ThreadScriptCheck, 0, NULL) != -1)
+                        nScriptCheckThreads++;
+            printf("Using %d script verification threads\n", nScriptCheckThreads + 1);
+        }
+
+        if (nScriptCheckThreads == 0 || nJobs < 2)
+        {
+            for (unsigned int n = 0; n < nJobs; n++)
+                if (!pfnJob(parg, n))
+                    return false;
+            return true;
+        }
+
+        CRITICAL_BLOCK(cs_ScriptCheck)
+        {
+            pfnScriptCheckJob = pfnJob;
+            pScriptCheckArg = parg;
+            nScriptCheckJobs = nJobs;
+            nScriptCheckNext = 0;
+            nScriptCheckTodo = nJobs;
+            fScriptCheckFailed = false;
+            ResetEvent(hScriptCheckDone);
+            SetEvent(hScriptCheckWork);
+        }
+        DoScriptChecks();
+        WaitForSingleObject(hScriptCheckDone, INFINITE);
+
+        bool fRet;
+        CRITICAL_BLOCK(cs_ScriptCheck)
+        {
+            pfnScriptCheckJob = NULL;
+            pScriptCheckArg = NULL;
+            fRet = !fScriptCheckFailed;
+        }
+        return fRet;
+    }
+    return false;
+}
+
+static bool ScriptCheckJob(void* parg, unsigned int n)
+{
+    return (*(vector<CScriptCheck>*)parg)[n].Check();
+}
+
+bool RunScriptChecks(vector<CScriptCheck>& vChecks)
+{
+    return RunParallel(ScriptCheckJob, &vChecks, vChecks.size());
 }
@@ -324,7 +324,15 @@ inline string StackString(const vector<vector<unsigned char> >& vStack)
 
 
 
-class CScript : public vector<unsigned char>
+//
+// Scripts are kept inline up to the size of a scriptSig with one signature
+// and a full public key, which covers nearly every scriptSig and
+// scriptPubKey, so parsing or copying a transaction doesn't need a heap
+// block per script.
+//
+typedef CSmallVector<unsigned char, 140> CScriptBase;
+
+class CScript : public CScriptBase
 {
 protected:
     CScript& push_int64(int64 n)
@@ -357,11 +365,9 @@ protected:
 
 public:
     CScript() { }
-    CScript(const CScript& b) : vector<unsigned char>(b.begin(), b.end()) { }
-    CScript(const_iterator pbegin, const_iterator pend) : vector<unsigned char>(pbegin, pend) { }
-#ifndef _MSC_VER
-    CScript(const unsigned char* pbegin, const unsigned char* pend) : vector<unsigned char>(pbegin, pend) { }
-#endif
+    CScript(const CScript& b) : CScriptBase(b) { }
+    template<typename InputIterator>
+    CScript(InputIterator pbegin, InputIterator pend) : CScriptBase(pbegin, pend) { }
 
     CScript& operator+=(const CScript& b)
     {
@@ -582,16 +588,96 @@ public:
 
 
 
+inline unsigned int GetSerializeSize(const CScript& v, int nType, int nVersion)
+{
+    return GetSerializeSize((const CScriptBase&)v, nType, nVersion);
+}
+
+template<typename Stream>
+void Serialize(Stream& os, const CScript& v, int nType, int nVersion)
+{
+    Serialize(os, (const CScriptBase&)v, nType, nVersion);
+}
+
+template<typename Stream>
+void Unserialize(Stream& is, CScript& v, int nType, int nVersion)
+{
+    Unserialize(is, (CScriptBase&)v, nType, nVersion);
+}
+
+
+
+
+
 
 
 
+//
+// Parts of a transaction's signature hash that are the same for every input.
+// The SIGHASH_ALL hash of input n is the transaction serialized with every
+// scriptSig empty except n's, which is replaced by the scriptCode.  The
+// blanked serialization and the hash state up to each input are worked out
+// once, so an input only has to hash its scriptCode and the bytes after it
+// instead of copying and serializing the whole transaction again.  Only
+// depends on the prevouts, sequences, outputs and lock time, so it stays
+// valid while the scriptSigs are being signed.  Built on first use, call
+// Init before sharing one between threads.
+//
+class CSignatureHashContext
+{
+public:
+    const CTransaction& txTo;
+
+    CSignatureHashContext(const CTransaction& txToIn) : txTo(txToIn), fInit(false) { }
+    void Init() const;
+    uint256 SignatureHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+
+private:
+    mutable bool fInit;
+    mutable vector<char> vchBlank;
+    mutable vector<unsigned int> vInputPos;
+    mutable vector<unsigned int> vScriptPos;
+    mutable vector<CHashWriter> vInputHasher;
+};
 
+//
+// Script check of one input, ConnectBlock queues these while it does the
+// input lookups and runs them all at the end on the verification threads
+//
+class CScriptCheck
+{
+public:
+    CScript scriptPubKey;
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    const CSignatureHashContext* psighash;
+
+    CScriptCheck()
+    {
+        ptxTo = NULL;
+        nIn = 0;
+        psighash = NULL;
+    }
+
+    CScriptCheck(const CScript& scriptPubKeyIn, const CTransaction* ptxToIn, unsigned int nInIn)
+    {
+        scriptPubKey = scriptPubKeyIn;
+        ptxTo = ptxToIn;
+        nIn = nInIn;
+        psighash = NULL;
+    }
+
+    bool Check() const;
+};
 
 bool EvalScript(const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType=0,
-                vector<vector<unsigned char> >* pvStackRet=NULL);
+                vector<vector<unsigned char> >* pvStackRet=NULL, const CSignatureHashContext* psighash=NULL);
 uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 bool IsMine(const CScript& scriptPubKey);
 bool ExtractPubKey(const CScript& scriptPubKey, bool fMineOnly, vector<unsigned char>& vchPubKeyRet);
 bool ExtractHash160(const CScript& scriptPubKey, uint160& hash160Ret);
-bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL, CScript scriptPrereq=CScript());
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType=0);
+bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL, CScript scriptPrereq=CScript(), const CSignatureHashContext* psighash=NULL);
+bool SignSignatures(const vector<const CTransaction*>& vpFrom, CTransaction& txTo, int nHashType=SIGHASH_ALL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType=0, const CSignatureHashContext* psighash=NULL);
+bool RunParallel(bool (*pfnJob)(void* parg, unsigned int n), void* parg, unsigned int nJobs);
+bool RunScriptChecks(vector<CScriptCheck>& vChecks);
@@ -0,0 +1,169 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+// 可能: 指示迭代器是否指向脚本中的非零字节。
+// 换句话说，它检查迭代器当前指向的值是否为非零值，如果是，
+// 则返回true，否则返回false。在比特币的代码库中，
+// CastToBool函数被用于评估脚本中的条件表达式。
+inline bool CastToBool(const vector<unsigned char>& vch)
+{
+    // Any nonzero magnitude byte is true and all zeros is false.  Only
+    // negative zero, a lone sign bit, is left to CBigNum.
+    for (unsigned int i = 0; i < vch.size(); i++)
+    {
+        if (vch[i] != 0)
+        {
+            if (i == vch.size() - 1 && vch[i] == 0x80)
+                break;
+            return true;
+        }
+    }
+    if (vch.empty() || vch.back() != 0x80)
+        return false;
+    return (CBigNum(vch) != CBigNum(0));
+}
+
+
+
+//
+// Script numbers are CBigNum's little endian sign and magnitude format.
+// Almost all of them are small, so the numeric ops work on int64 when the
+// operands are at most 7 bytes and the result is sure to fit.  Anything
+// else, including negative zero, goes through CBigNum as before.
+// test_scriptnum checks these against the CBigNum code.
+//
+inline bool GetScriptNum(const vector<unsigned char>& vch, int64& nRet)
+{
+    if (vch.size() > 7)
+        return false;
+    if (vch.empty())
+    {
+        nRet = 0;
+        return true;
+    }
+    uint64 n = 0;
+    for (unsigned int i = 0; i < vch.size(); i++)
+        n |= (uint64)vch[i] << (8 * i);
+    uint64 nSignBit = (uint64)0x80 << (8 * (vch.size() - 1));
+    if (n & nSignBit)
+    {
+        n &= ~nSignBit;
+        if (n == 0)
+            return false;
+        nRet = -(int64)n;
+    }
+    else
+    {
+        nRet = (int64)n;
+    }
+    return true;
+}
+
+inline vector<unsigned char> ScriptNumVch(int64 n)
+{
+    // Same bytes as CBigNum(n).getvch()
+    vector<unsigned char> vch;
+    if (n == 0)
+        return vch;
+    bool fNegative = (n < 0);
+    uint64 nAbs = (fNegative ? -(uint64)n : (uint64)n);
+    while (nAbs)
+    {
+        vch.push_back(nAbs & 0xff);
+        nAbs >>= 8;
+    }
+    if (vch.back() & 0x80)
+        vch.push_back(fNegative ? 0x80 : 0);
+    else if (fNegative)
+        vch.back() |= 0x80;
+    return vch;
+}
+
+// CBigNum(vch).getint(), clamped to the int range the same way
+inline int ScriptNumToInt(const vector<unsigned char>& vch)
+{
+    int64 n;
+    if (!GetScriptNum(vch, n))
+        return CBigNum(vch).getint();
+    if (n > INT_MAX)
+        return INT_MAX;
+    if (n < -(int64)INT_MAX)
+        return INT_MIN;
+    return (int)n;
+}
+
+// The (in -- out) ops, same rules as EvalScriptNum
+inline bool EvalScriptNumUnary(opcodetype opcode, int64 n, int64& nRet)
+{
+    switch (opcode)
+    {
+    case OP_1ADD:       nRet = n + 1; break;
+    case OP_1SUB:       nRet = n - 1; break;
+    case OP_2MUL:       nRet = n * 2; break;
+    case OP_2DIV:       nRet = n / 2; break;
+    case OP_NEGATE:     nRet = -n; break;
+    case OP_ABS:        nRet = (n < 0 ? -n : n); break;
+    case OP_NOT:        nRet = (n == 0); break;
+    case OP_0NOTEQUAL:  nRet = (n != 0); break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Operands are under 2^55 in magnitude, so add and subtract can't overflow.
+// Returns false to leave the op to CBigNum, including the cases that fail
+// the script.
+inline bool EvalScriptNum(opcodetype opcode, int64 n1, int64 n2, int64& nRet)
+{
+    static const int64 nMulLimit = (int64)1 << 31;
+    switch (opcode)
+    {
+    case OP_ADD:                nRet = n1 + n2; break;
+    case OP_SUB:                nRet = n1 - n2; break;
+    case OP_MUL:
+        if (n1 >= nMulLimit || n1 <= -nMulLimit || n2 >= nMulLimit || n2 <= -nMulLimit)
+            return false;
+        nRet = n1 * n2;
+        break;
+    case OP_DIV:
+        if (n2 == 0)
+            return false;
+        nRet = n1 / n2;
+        break;
+    case OP_MOD:
+        if (n2 == 0)
+            return false;
+        nRet = n1 % n2;
+        break;
+    case OP_LSHIFT:
+        if (n2 < 0 || n2 > 8)
+            return false;
+        nRet = (n1 < 0 ? -((-n1) << n2) : n1 << n2);
+        break;
+    case OP_RSHIFT:
+        // CBigNum passes the count to BN_rshift as an int
+        if (n2 < 0 || n2 > INT_MAX)
+            return false;
+        if (n2 > 62)
+            nRet = 0;
+        else
+            nRet = (n1 < 0 ? -((-n1) >> n2) : n1 >> n2);
+        break;
+    case OP_BOOLAND:            nRet = (n1 != 0 && n2 != 0); break;
+    case OP_BOOLOR:             nRet = (n1 != 0 || n2 != 0); break;
+    case OP_NUMEQUAL:           nRet = (n1 == n2); break;
+    case OP_NUMEQUALVERIFY:     nRet = (n1 == n2); break;
+    case OP_NUMNOTEQUAL:        nRet = (n1 != n2); break;
+    case OP_LESSTHAN:           nRet = (n1 < n2); break;
+    case OP_GREATERTHAN:        nRet = (n1 > n2); break;
+    case OP_LESSTHANOREQUAL:    nRet = (n1 <= n2); break;
+    case OP_GREATERTHANOREQUAL: nRet = (n1 >= n2); break;
+    case OP_MIN:                nRet = (n1 < n2 ? n1 : n2); break;
+    case OP_MAX:                nRet = (n1 > n2 ? n1 : n2); break;
+    default:
+        return false;
+    }
+    return true;
+}
@@ -16,6 +16,7 @@ typedef unsigned long long  uint64;
 #define for  if (false) ; else for
 #endif
 class CScript;
+template<typename T, unsigned int N> class CSmallVector;
 class CDataStream;
 class CAutoFile;
 
@@ -356,7 +357,12 @@ template<typename Stream, typename T, typename A> void Unserialize_impl(Stream&
 template<typename Stream, typename T, typename A> void Unserialize_impl(Stream& is, std::vector<T, A>& v, int nType, int nVersion, const boost::false_type&);
 template<typename Stream, typename T, typename A> inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersion=VERSION);
 
-// others derived from vector
+// small vector
+template<typename T, unsigned int N> unsigned int GetSerializeSize(const CSmallVector<T, N>& v, int nType, int nVersion=VERSION);
+template<typename Stream, typename T, unsigned int N> void Serialize(Stream& os, const CSmallVector<T, N>& v, int nType, int nVersion=VERSION);
+template<typename Stream, typename T, unsigned int N> void Unserialize(Stream& is, CSmallVector<T, N>& v, int nType, int nVersion=VERSION);
+
+// CScript, defined after the class in script.h
 extern inline unsigned int GetSerializeSize(const CScript& v, int nType, int nVersion=VERSION);
 template<typename Stream> void Serialize(Stream& os, const CScript& v, int nType, int nVersion=VERSION);
 template<typename Stream> void Unserialize(Stream& is, CScript& v, int nType, int nVersion=VERSION);
@@ -536,23 +542,36 @@ inline void Unserialize(Stream& is, std::vector<T, A>& v, int nType, int nVersio
 
 
 //
-// others derived from vector
+// small vector, same format as a vector of plain data
 //
-inline unsigned int GetSerializeSize(const CScript& v, int nType, int nVersion)
+template<typename T, unsigned int N>
+unsigned int GetSerializeSize(const CSmallVector<T, N>& v, int nType, int nVersion)
 {
-    return GetSerializeSize((const vector<unsigned char>&)v, nType, nVersion);
+    return (GetSizeOfCompactSize(v.size()) + v.size() * sizeof(T));
 }
 
-template<typename Stream>
-void Serialize(Stream& os, const CScript& v, int nType, int nVersion)
+template<typename Stream, typename T, unsigned int N>
+void Serialize(Stream& os, const CSmallVector<T, N>& v, int nType, int nVersion)
 {
-    Serialize(os, (const vector<unsigned char>&)v, nType, nVersion);
+    WriteCompactSize(os, v.size());
+    if (!v.empty())
+        os.write((char*)&v[0], v.size() * sizeof(T));
 }
 
-template<typename Stream>
-void Unserialize(Stream& is, CScript& v, int nType, int nVersion)
+template<typename Stream, typename T, unsigned int N>
+void Unserialize(Stream& is, CSmallVector<T, N>& v, int nType, int nVersion)
 {
-    Unserialize(is, (vector<unsigned char>&)v, nType, nVersion);
+    // Limit size per read so bogus size value won't cause out of memory
+    v.clear();
+    unsigned int nSize = ReadCompactSize(is);
+    unsigned int i = 0;
+    while (i < nSize)
+    {
+        unsigned int blk = min(nSize - i, 1 + 4999999 / sizeof(T));
+        v.resize(i + blk);
+        is.read((char*)&v[i], blk * sizeof(T));
+        i += blk;
+    }
 }
 
 
@@ -726,6 +745,57 @@ struct secure_allocator : public std::allocator<T>
 
 
 
+//
+// Allocator for stream buffers.  Blocks are recycled through a pool in
+// util.cpp rather than going back to the heap, and are only cleared on the
+// way back when the stream was made secure, for the wallet records that can
+// hold private keys.  Network and block data don't need the memset.
+//
+void* StreamBufferAlloc(size_t nSize);
+void StreamBufferFree(void* p, size_t nSize);
+
+template<typename T>
+struct stream_allocator : public std::allocator<T>
+{
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type  difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    bool fSecure;
+    stream_allocator(bool fSecureIn=false) throw() : fSecure(fSecureIn) {}
+    stream_allocator(const stream_allocator& a) throw() : base(a), fSecure(a.fSecure) {}
+    template<typename _Other> stream_allocator(const stream_allocator<_Other>& a) throw() : fSecure(a.fSecure) {}
+    ~stream_allocator() throw() {}
+    template<typename _Other> struct rebind
+    { typedef stream_allocator<_Other> other; };
+
+    T* allocate(size_type n, const void* hint=0)
+    {
+        return (T*)StreamBufferAlloc(sizeof(T) * n);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (p == NULL)
+            return;
+        if (fSecure)
+            memset(p, 0, sizeof(T) * n);
+        StreamBufferFree(p, sizeof(T) * n);
+    }
+};
+
+// Buffers can only move between streams that clear them the same way
+template<typename T>
+inline bool operator==(const stream_allocator<T>& a, const stream_allocator<T>& b) { return a.fSecure == b.fSecure; }
+template<typename T>
+inline bool operator!=(const stream_allocator<T>& a, const stream_allocator<T>& b) { return a.fSecure != b.fSecure; }
+
+
+
 //
 // Double ended buffer combining vector and stream-like interfaces.
 // >> and << read and write unformatted data using the above serialization templates.
@@ -734,7 +804,7 @@ struct secure_allocator : public std::allocator<T>
 class CDataStream
 {
 protected:
-    typedef vector<char, secure_allocator<char> > vector_type;
+    typedef vector<char, stream_allocator<char> > vector_type;
     vector_type vch;
     unsigned int nReadPos;
     short state;
@@ -753,7 +823,7 @@ public:
     typedef vector_type::const_iterator   const_iterator;
     typedef vector_type::reverse_iterator reverse_iterator;
 
-    explicit CDataStream(int nTypeIn=0, int nVersionIn=VERSION)
+    explicit CDataStream(int nTypeIn=0, int nVersionIn=VERSION, bool fSecure=false) : vch(allocator_type(fSecure))
     {
         Init(nTypeIn, nVersionIn);
     }
@@ -908,6 +978,19 @@ public:
         return true;
     }
 
+    void swap(CDataStream& b)
+    {
+        // The vectors trade buffers but keep their allocators, so a secure
+        // stream's buffer must never end up in one that won't clear it
+        assert(vch.get_allocator() == b.vch.get_allocator());
+        vch.swap(b.vch);
+        std::swap(nReadPos, b.nReadPos);
+        std::swap(state, b.state);
+        std::swap(exceptmask, b.exceptmask);
+        std::swap(nType, b.nType);
+        std::swap(nVersion, b.nVersion);
+    }
+
 
     //
     // Stream subset
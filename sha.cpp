@@ -12,6 +12,11 @@
 #include <assert.h>
 #include <memory.h>
 #include "sha.h"
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
 
 // CryptoPP是一个开源的加密算法库，
 // 提供包括对称加密、公钥加密、哈希函数、消息认证码等多种密码学算法。
@@ -106,7 +111,7 @@ void SHA256::InitState(HashWordType *state)
     memcpy(state, s, sizeof(s));
 }
 
-static const word32 SHA256_K[64] = {
+extern const word32 SHA256_K[64] = {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
     0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -148,7 +153,7 @@ static const word32 SHA256_K[64] = {
 #define s0(x) (rotrFixed(x,7)^rotrFixed(x,18)^(x>>3))
 #define s1(x) (rotrFixed(x,17)^rotrFixed(x,19)^(x>>10))
 
-void SHA256::Transform(word32 *state, const word32 *data)
+static void SHA256_Transform_Scalar(word32 *state, const word32 *data)
 {
     word32 W[16];
     word32 T[8];
@@ -173,6 +178,296 @@ void SHA256::Transform(word32 *state, const word32 *data)
     state[7] += h(0);
 }
 
+// Switched to the SHA extensions at startup when the CPU has them
+typedef void (*TransformFn)(word32 *state, const word32 *data);
+static TransformFn pfnTransform = SHA256_Transform_Scalar;
+
+void SHA256::Transform(word32 *state, const word32 *data)
+{
+    pfnTransform(state, data);
+}
+
+// Double SHA-256 of a Bitcoin block header starting from the state after
+// its first 64-byte chunk.  The second SHA-256 is over the 32-byte first
+// hash, so its single padded block is fixed except for the first 8 words.
+void SHA256_DoubleHashMidstate(word32 *hash, const word32 *midstate, const word32 *data)
+{
+    word32 buf[16];
+    memcpy(buf, midstate, 32);
+    SHA256::Transform(buf, data);
+    buf[8] = 0x80000000;
+    buf[9] = buf[10] = buf[11] = buf[12] = buf[13] = buf[14] = 0;
+    buf[15] = 256;
+    SHA256::InitState(hash);
+    SHA256::Transform(hash, buf);
+}
+
+// SHA extensions and multi-buffer SHA-256.  The fastest kernel the CPU
+// supports is picked once at startup and only kept if it agrees with the
+// scalar code above.
+
+void SHA256_Transform_SHANI(word32 *state, const word32 *data);
+void SHA256_DoubleHash64_SSE2(byte *out, const byte *in);
+void SHA256_DoubleHashMidstate_SSE2(word32 *hash, const word32 *midstate, const word32 *data, const word32 *nonces);
+void SHA256_DoubleHash64_AVX2(byte *out, const byte *in);
+void SHA256_DoubleHashMidstate_AVX2(word32 *hash, const word32 *midstate, const word32 *data, const word32 *nonces);
+
+static void SHA256_DoubleHash64_Scalar(byte *out, const byte *in)
+{
+    word32 midstate[8];
+    word32 data[16];
+    for (int i = 0; i < 16; i++)
+        data[i] = ((word32)in[4*i] << 24) | ((word32)in[4*i+1] << 16) | ((word32)in[4*i+2] << 8) | (word32)in[4*i+3];
+    SHA256::InitState(midstate);
+    SHA256::Transform(midstate, data);
+
+    // The second chunk of a 64-byte message is only padding
+    data[0] = 0x80000000;
+    for (int i = 1; i < 15; i++)
+        data[i] = 0;
+    data[15] = 512;
+    word32 hash[8];
+    SHA256_DoubleHashMidstate(hash, midstate, data);
+    for (int i = 0; i < 8; i++)
+    {
+        out[4*i]   = (byte)(hash[i] >> 24);
+        out[4*i+1] = (byte)(hash[i] >> 16);
+        out[4*i+2] = (byte)(hash[i] >> 8);
+        out[4*i+3] = (byte)hash[i];
+    }
+}
+
+static void SHA256_DoubleHashMidstate_Scalar(word32 *hash, const word32 *midstate, const word32 *data, const word32 *nonces)
+{
+    word32 buf[16];
+    memcpy(buf, data, sizeof(buf));
+    buf[3] = nonces[0];
+    SHA256_DoubleHashMidstate(hash, midstate, buf);
+}
+
+typedef void (*DoubleHash64Fn)(byte *out, const byte *in);
+typedef void (*DoubleHashMidstateFn)(word32 *hash, const word32 *midstate, const word32 *data, const word32 *nonces);
+
+static unsigned int nLanes = 1;
+static const char *pszImplementation = "scalar";
+static DoubleHash64Fn pfnDoubleHash64 = SHA256_DoubleHash64_Scalar;
+static DoubleHashMidstateFn pfnDoubleHashMidstate = SHA256_DoubleHashMidstate_Scalar;
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+
+static void GetCPUID(word32 leaf, word32 subleaf, word32& a, word32& b, word32& c, word32& d)
+{
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    a = r[0]; b = r[1]; c = r[2]; d = r[3];
+#else
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+#endif
+}
+
+static word32 GetXCR0()
+{
+#ifdef _MSC_VER
+    return (word32)_xgetbv(0);
+#else
+    word32 a, d;
+    __asm__ ("xgetbv" : "=a" (a), "=d" (d) : "c" (0));
+    return a;
+#endif
+}
+
+// Run a kernel over a few messages and compare every lane against the scalar path
+static bool SHA256_CheckKernel(unsigned int n, DoubleHash64Fn pfn64, DoubleHashMidstateFn pfnMidstate)
+{
+    byte in[8*64];
+    byte out[8*32], check[32];
+    for (unsigned int i = 0; i < sizeof(in); i++)
+        in[i] = (byte)(i * 7 + (i >> 6));
+    pfn64(out, in);
+    for (unsigned int j = 0; j < n; j++)
+    {
+        SHA256_DoubleHash64_Scalar(check, in + 64*j);
+        if (memcmp(out + 32*j, check, 32) != 0)
+            return false;
+    }
+
+    word32 midstate[8], data[16], nonces[8];
+    word32 hash[8*8], hashCheck[8];
+    SHA256::InitState(midstate);
+    SHA256::Transform(midstate, (const word32*)in);
+    for (int i = 0; i < 16; i++)
+        data[i] = 0x01010101 * (i + 1);
+    for (unsigned int j = 0; j < n; j++)
+        nonces[j] = 0x9e3779b9 * (j + 1);
+    pfnMidstate(hash, midstate, data, nonces);
+    for (unsigned int j = 0; j < n; j++)
+    {
+        SHA256_DoubleHashMidstate_Scalar(hashCheck, midstate, data, nonces + j);
+        if (memcmp(hash + 8*j, hashCheck, sizeof(hashCheck)) != 0)
+            return false;
+    }
+    return true;
+}
+
+static bool SHA256_CheckTransform(TransformFn pfn)
+{
+    word32 state[8], check[8], data[16];
+    SHA256::InitState(state);
+    SHA256::InitState(check);
+    for (int n = 0; n < 4; n++)
+    {
+        for (int i = 0; i < 16; i++)
+            data[i] = 0x9e3779b9 * (16 * n + i + 1);
+        pfn(state, data);
+        SHA256_Transform_Scalar(check, data);
+    }
+    return memcmp(state, check, sizeof(state)) == 0;
+}
+
+static void SHA256_SelectImplementation()
+{
+    word32 a, b, c, d;
+    GetCPUID(0, 0, a, b, c, d);
+    word32 nMaxLeaf = a;
+    GetCPUID(1, 0, a, b, c, d);
+    bool fSSE2 = (d & (1 << 26)) != 0;
+    bool fSSE41 = (c & (1 << 9)) && (c & (1 << 19));
+    bool fAVX = (c & (1 << 27)) && (c & (1 << 28)) && (GetXCR0() & 6) == 6;
+    bool fAVX2 = false;
+    bool fSHA = false;
+    if (nMaxLeaf >= 7)
+    {
+        GetCPUID(7, 0, a, b, c, d);
+        fAVX2 = fAVX && (b & (1 << 5));
+        fSHA = fSSE41 && (b & (1 << 29));
+    }
+
+    // One SHA-NI transform beats the multi-buffer kernels, the one lane
+    // scalar wrappers below pick it up through SHA256::Transform
+    if (fSHA && SHA256_CheckTransform(SHA256_Transform_SHANI))
+    {
+        pfnTransform = SHA256_Transform_SHANI;
+        pszImplementation = "sha-ni";
+    }
+    else if (fAVX2 && SHA256_CheckKernel(8, SHA256_DoubleHash64_AVX2, SHA256_DoubleHashMidstate_AVX2))
+    {
+        nLanes = 8;
+        pszImplementation = "avx2 8-way";
+        pfnDoubleHash64 = SHA256_DoubleHash64_AVX2;
+        pfnDoubleHashMidstate = SHA256_DoubleHashMidstate_AVX2;
+    }
+    else if (fSSE2 && SHA256_CheckKernel(4, SHA256_DoubleHash64_SSE2, SHA256_DoubleHashMidstate_SSE2))
+    {
+        nLanes = 4;
+        pszImplementation = "sse2 4-way";
+        pfnDoubleHash64 = SHA256_DoubleHash64_SSE2;
+        pfnDoubleHashMidstate = SHA256_DoubleHashMidstate_SSE2;
+    }
+}
+#else
+static void SHA256_SelectImplementation()
+{
+}
+#endif
+
+class CSHA256Init
+{
+public:
+    CSHA256Init()
+    {
+        SHA256_SelectImplementation();
+    }
+}
+instance_of_csha256init;
+
+unsigned int SHA256_Lanes()
+{
+    return nLanes;
+}
+
+const char *SHA256_Implementation()
+{
+    return pszImplementation;
+}
+
+void SHA256_DoubleHash64(byte *out, const byte *in, size_t n)
+{
+    while (n >= nLanes)
+    {
+        pfnDoubleHash64(out, in);
+        out += 32 * nLanes;
+        in += 64 * nLanes;
+        n -= nLanes;
+    }
+    for (; n > 0; n--, out += 32, in += 64)
+        SHA256_DoubleHash64_Scalar(out, in);
+}
+
+void SHA256_DoubleHashMidstateNonces(word32 *hash, const word32 *midstate, const word32 *data, const word32 *nonces)
+{
+    pfnDoubleHashMidstate(hash, midstate, data, nonces);
+}
+
+static void SHA256_TransformBytes(word32 *state, const byte *p)
+{
+    word32 data[16];
+    for (int i = 0; i < 16; i++, p += 4)
+        data[i] = ((word32)p[0] << 24) | ((word32)p[1] << 16) | ((word32)p[2] << 8) | (word32)p[3];
+    SHA256::Transform(state, data);
+}
+
+void SHA256Context::Init()
+{
+    SHA256::InitState(state);
+    nBytes = 0;
+}
+
+void SHA256Context::Update(const void *pdata, size_t len)
+{
+    const byte *p = (const byte *)pdata;
+    size_t nBuf = (size_t)(nBytes % 64);
+    nBytes += len;
+    if (nBuf > 0)
+    {
+        size_t n = (len < 64 - nBuf ? len : 64 - nBuf);
+        memcpy(buf + nBuf, p, n);
+        p += n;
+        len -= n;
+        if (nBuf + n < 64)
+            return;
+        SHA256_TransformBytes(state, buf);
+    }
+    for (; len >= 64; p += 64, len -= 64)
+        SHA256_TransformBytes(state, p);
+    memcpy(buf, p, len);
+}
+
+void SHA256Context::Final(byte *digest)
+{
+    static const byte pad[64] = {0x80};
+    byte sizedesc[8];
+    word64 nBits = nBytes << 3;
+    for (int i = 0; i < 8; i++)
+        sizedesc[i] = (byte)(nBits >> (56 - 8 * i));
+    Update(pad, 1 + ((119 - (size_t)(nBytes % 64)) % 64));
+    Update(sizedesc, 8);
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4*i]   = (byte)(state[i] >> 24);
+        digest[4*i+1] = (byte)(state[i] >> 16);
+        digest[4*i+2] = (byte)(state[i] >> 8);
+        digest[4*i+3] = (byte)state[i];
+    }
+}
+
+void SHA256_Hash(byte *digest, const void *pdata, size_t len)
+{
+    SHA256Context ctx;
+    ctx.Update(pdata, len);
+    ctx.Final(digest);
+}
+
 /*
 // smaller but slower
 void SHA256_Transform(word32 *state, const word32 *data)
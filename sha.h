@@ -138,6 +138,39 @@ public:
     static const char * StaticAlgorithmName() {return "SHA-256";}
 };
 
+// Bitcoin block header hashing.  midstate is the SHA-256 state after the
+// first 64-byte chunk of the 80-byte header, data is the padded second chunk
+// in SHA-256 word order.  Writes the double SHA-256 state words to hash.
+void SHA256_DoubleHashMidstate(word32 *hash, const word32 *midstate, const word32 *data);
+
+// Multi-buffer versions, run on SSE2 (4 lanes) or AVX2 (8 lanes) when the CPU
+// has them.  SHA256_DoubleHash64 hashes n independent 64-byte messages from in
+// to n 32-byte double SHA-256 digests at out.  SHA256_DoubleHashMidstateNonces
+// hashes SHA256_Lanes() copies of data with word 3 replaced by nonces[i],
+// writing 8 words per lane to hash.
+unsigned int SHA256_Lanes();
+const char *SHA256_Implementation();
+void SHA256_DoubleHash64(byte *out, const byte *in, size_t n);
+void SHA256_DoubleHashMidstateNonces(word32 *hash, const word32 *midstate, const word32 *data, const word32 *nonces);
+
+// Incremental SHA-256 of a byte stream, on whichever SHA256::Transform was
+// selected at startup
+class SHA256Context
+{
+public:
+    SHA256Context() { Init(); }
+    void Init();
+    void Update(const void *pdata, size_t len);
+    void Final(byte *digest);
+
+private:
+    word32 state[8];
+    byte buf[64];
+    word64 nBytes;
+};
+
+void SHA256_Hash(byte *digest, const void *pdata, size_t len);
+
 // implements the SHA-224 standard
 class SHA224
 {
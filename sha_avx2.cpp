@@ -0,0 +1,142 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+// 8-way SHA-256, each 32-bit lane of an AVX2 register carries a separate
+// message.  Only called by the dispatch in sha.cpp after it has checked the
+// CPU and compared the output against SHA256::Transform.
+
+#include <assert.h>
+#include <memory.h>
+#include "sha.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+
+namespace CryptoPP
+{
+
+extern const word32 SHA256_K[64];
+
+typedef __m256i vec;
+
+static inline vec Add(vec x, vec y) { return _mm256_add_epi32(x, y); }
+static inline vec Add(vec x, vec y, vec z) { return Add(Add(x, y), z); }
+static inline vec Xor(vec x, vec y) { return _mm256_xor_si256(x, y); }
+static inline vec Xor(vec x, vec y, vec z) { return Xor(Xor(x, y), z); }
+static inline vec And(vec x, vec y) { return _mm256_and_si256(x, y); }
+static inline vec Or(vec x, vec y) { return _mm256_or_si256(x, y); }
+static inline vec Set(word32 x) { return _mm256_set1_epi32((int)x); }
+#define Shr(x,n) _mm256_srli_epi32(x, n)
+#define Rotr(x,n) Or(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32-n))
+
+static inline vec S0(vec x) { return Xor(Rotr(x, 2), Rotr(x, 13), Rotr(x, 22)); }
+static inline vec S1(vec x) { return Xor(Rotr(x, 6), Rotr(x, 11), Rotr(x, 25)); }
+static inline vec s0(vec x) { return Xor(Rotr(x, 7), Rotr(x, 18), Shr(x, 3)); }
+static inline vec s1(vec x) { return Xor(Rotr(x, 17), Rotr(x, 19), Shr(x, 10)); }
+static inline vec Ch(vec x, vec y, vec z) { return Xor(z, And(x, Xor(y, z))); }
+static inline vec Maj(vec x, vec y, vec z) { return Or(And(x, y), And(z, Or(x, y))); }
+
+static void Transform(vec *state, const vec *data)
+{
+    vec W[16];
+    vec a = state[0], b = state[1], c = state[2], d = state[3];
+    vec e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        if (i < 16)
+            W[i] = data[i];
+        else
+            W[i&15] = Add(Add(W[i&15], s1(W[(i-2)&15])), W[(i-7)&15], s0(W[(i-15)&15]));
+        vec t1 = Add(Add(h, S1(e)), Add(Ch(e, f, g), Set(SHA256_K[i]), W[i&15]));
+        vec t2 = Add(S0(a), Maj(a, b, c));
+        h = g; g = f; f = e; e = Add(d, t1);
+        d = c; c = b; b = a; a = Add(t1, t2);
+    }
+    state[0] = Add(state[0], a); state[1] = Add(state[1], b);
+    state[2] = Add(state[2], c); state[3] = Add(state[3], d);
+    state[4] = Add(state[4], e); state[5] = Add(state[5], f);
+    state[6] = Add(state[6], g); state[7] = Add(state[7], h);
+}
+
+static inline word32 ReadBE(const byte *p)
+{
+    return ((word32)p[0] << 24) | ((word32)p[1] << 16) | ((word32)p[2] << 8) | (word32)p[3];
+}
+
+static inline void WriteBE(byte *p, word32 x)
+{
+    p[0] = (byte)(x >> 24); p[1] = (byte)(x >> 16); p[2] = (byte)(x >> 8); p[3] = (byte)x;
+}
+
+// Second hash of a double SHA-256, state holds the first hash
+static void DoubleHashFinal(vec *state)
+{
+    vec buf[16];
+    for (int i = 0; i < 8; i++)
+        buf[i] = state[i];
+    buf[8] = Set(0x80000000);
+    for (int i = 9; i < 15; i++)
+        buf[i] = Set(0);
+    buf[15] = Set(256);
+    word32 init[8];
+    SHA256::InitState(init);
+    for (int i = 0; i < 8; i++)
+        state[i] = Set(init[i]);
+    Transform(state, buf);
+}
+
+void SHA256_DoubleHash64_AVX2(byte *out, const byte *in)
+{
+    word32 init[8];
+    SHA256::InitState(init);
+    vec state[8];
+    vec data[16];
+    for (int i = 0; i < 8; i++)
+        state[i] = Set(init[i]);
+    for (int i = 0; i < 16; i++)
+        data[i] = _mm256_set_epi32(ReadBE(in + 448 + 4*i), ReadBE(in + 384 + 4*i), ReadBE(in + 320 + 4*i), ReadBE(in + 256 + 4*i),
+                                   ReadBE(in + 192 + 4*i), ReadBE(in + 128 + 4*i), ReadBE(in + 64 + 4*i), ReadBE(in + 4*i));
+    Transform(state, data);
+
+    // Padding block for a 64-byte message
+    data[0] = Set(0x80000000);
+    for (int i = 1; i < 15; i++)
+        data[i] = Set(0);
+    data[15] = Set(512);
+    Transform(state, data);
+
+    DoubleHashFinal(state);
+    for (int i = 0; i < 8; i++)
+    {
+        word32 lanes[8];
+        _mm256_storeu_si256((vec*)lanes, state[i]);
+        for (int j = 0; j < 8; j++)
+            WriteBE(out + 32*j + 4*i, lanes[j]);
+    }
+}
+
+void SHA256_DoubleHashMidstate_AVX2(word32 *hash, const word32 *midstate, const word32 *data, const word32 *nonces)
+{
+    vec state[8];
+    vec buf[16];
+    for (int i = 0; i < 8; i++)
+        state[i] = Set(midstate[i]);
+    for (int i = 0; i < 16; i++)
+        buf[i] = Set(data[i]);
+    buf[3] = _mm256_loadu_si256((const vec*)nonces);
+    Transform(state, buf);
+
+    DoubleHashFinal(state);
+    for (int i = 0; i < 8; i++)
+    {
+        word32 lanes[8];
+        _mm256_storeu_si256((vec*)lanes, state[i]);
+        for (int j = 0; j < 8; j++)
+            hash[8*j + i] = lanes[j];
+    }
+}
+
+}
+
+#endif
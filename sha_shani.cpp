@@ -0,0 +1,58 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+// SHA-256 compression function on the x86 SHA extensions.  Same interface as
+// SHA256::Transform, which switches to it at startup when CPUID reports the
+// extensions and the output matches the scalar code.
+
+#include <assert.h>
+#include <memory.h>
+#include "sha.h"
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+
+namespace CryptoPP
+{
+
+extern const word32 SHA256_K[64];
+
+void SHA256_Transform_SHANI(word32 *state, const word32 *data)
+{
+    // The round instructions want the state as ABEF and CDGH, high word first
+    __m128i t0 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0xB1);
+    __m128i t1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(state + 4)), 0x1B);
+    __m128i abef = _mm_alignr_epi8(t0, t1, 8);
+    __m128i cdgh = _mm_blend_epi16(t1, t0, 0xF0);
+    __m128i abefSave = abef;
+    __m128i cdghSave = cdgh;
+
+    // Data is already in SHA-256 word order, four message words per register
+    __m128i W[4];
+    for (int j = 0; j < 4; j++)
+        W[j] = _mm_loadu_si128((const __m128i*)(data + 4*j));
+
+    for (int j = 0; j < 16; j++)
+    {
+        if (j >= 4)
+            W[j&3] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(W[j&3], W[(j+1)&3]),
+                                                        _mm_alignr_epi8(W[(j+3)&3], W[(j+2)&3], 4)),
+                                          W[(j+3)&3]);
+        __m128i msg = _mm_add_epi32(W[j&3], _mm_loadu_si128((const __m128i*)(SHA256_K + 4*j)));
+        cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+        abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E));
+    }
+
+    abef = _mm_add_epi32(abef, abefSave);
+    cdgh = _mm_add_epi32(cdgh, cdghSave);
+
+    t0 = _mm_shuffle_epi32(abef, 0x1B);
+    t1 = _mm_shuffle_epi32(cdgh, 0xB1);
+    _mm_storeu_si128((__m128i*)state, _mm_blend_epi16(t0, t1, 0xF0));
+    _mm_storeu_si128((__m128i*)(state + 4), _mm_alignr_epi8(t1, t0, 8));
+}
+
+}
+
+#endif
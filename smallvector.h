@@ -0,0 +1,231 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+
+//
+// Vector with room for N elements inside the object, for the many small
+// arrays that would otherwise each be a separate heap block.  It only goes
+// to the heap when it grows past N, and then behaves like std::vector.
+// Iterators are plain pointers and are invalidated the same way.
+//
+// T has to be a plain data type, elements are moved around with memcpy and
+// never constructed or destroyed.
+//
+template<typename T, unsigned int N>
+class CSmallVector
+{
+public:
+    typedef T value_type;
+    typedef unsigned int size_type;
+    typedef ptrdiff_t difference_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+
+protected:
+    unsigned int nSize;
+    unsigned int nCapacity;
+    union
+    {
+        T pInline[N];
+        T* pHeap;
+    };
+
+    bool IsInline() const { return nCapacity <= N; }
+
+    void Reallocate(unsigned int nNewCapacity)
+    {
+        T* pNew = (T*)malloc(nNewCapacity * sizeof(T));
+        if (pNew == NULL)
+            throw std::bad_alloc();
+        if (nSize > 0)
+            memcpy(pNew, begin(), nSize * sizeof(T));
+        if (!IsInline())
+            free(pHeap);
+        pHeap = pNew;
+        nCapacity = nNewCapacity;
+    }
+
+    unsigned int GrowCapacity(unsigned int nNeed) const
+    {
+        return max(nNeed, 2 * nCapacity);
+    }
+
+public:
+    CSmallVector()
+    {
+        nSize = 0;
+        nCapacity = N;
+    }
+
+    CSmallVector(const CSmallVector& b)
+    {
+        nSize = 0;
+        nCapacity = N;
+        assign(b.begin(), b.end());
+    }
+
+    template<typename InputIterator>
+    CSmallVector(InputIterator first, InputIterator last)
+    {
+        nSize = 0;
+        nCapacity = N;
+        assign(first, last);
+    }
+
+    ~CSmallVector()
+    {
+        if (!IsInline())
+            free(pHeap);
+    }
+
+    CSmallVector& operator=(const CSmallVector& b)
+    {
+        if (this != &b)
+            assign(b.begin(), b.end());
+        return *this;
+    }
+
+    iterator begin()                    { return IsInline() ? pInline : pHeap; }
+    const_iterator begin() const        { return IsInline() ? pInline : pHeap; }
+    iterator end()                      { return begin() + nSize; }
+    const_iterator end() const          { return begin() + nSize; }
+    size_type size() const              { return nSize; }
+    size_type capacity() const          { return nCapacity; }
+    bool empty() const                  { return nSize == 0; }
+    T& operator[](size_type i)          { return begin()[i]; }
+    const T& operator[](size_type i) const { return begin()[i]; }
+    T& front()                          { return begin()[0]; }
+    const T& front() const              { return begin()[0]; }
+    T& back()                           { return begin()[nSize - 1]; }
+    const T& back() const               { return begin()[nSize - 1]; }
+
+    void reserve(size_type n)
+    {
+        if (n > nCapacity)
+            Reallocate(n);
+    }
+
+    void resize(size_type n, const T& value=T())
+    {
+        if (n > nCapacity)
+            Reallocate(GrowCapacity(n));
+        for (T* p = begin() + nSize; p < begin() + n; p++)
+            *p = value;
+        nSize = n;
+    }
+
+    void clear()
+    {
+        nSize = 0;
+    }
+
+    void push_back(const T& value)
+    {
+        insert(end(), value);
+    }
+
+    void pop_back()
+    {
+        nSize--;
+    }
+
+    iterator insert(iterator pos, const T& value)
+    {
+        // value may be one of our own elements
+        T tmp = value;
+        unsigned int nPos = pos - begin();
+        if (nSize + 1 > nCapacity)
+            Reallocate(GrowCapacity(nSize + 1));
+        T* p = begin();
+        memmove(p + nPos + 1, p + nPos, (nSize - nPos) * sizeof(T));
+        p[nPos] = tmp;
+        nSize++;
+        return p + nPos;
+    }
+
+    template<typename InputIterator>
+    iterator insert(iterator pos, InputIterator first, InputIterator last)
+    {
+        // The range may be part of this vector, so it's read before anything
+        // it points to is moved or freed
+        unsigned int nPos = pos - begin();
+        unsigned int n = std::distance(first, last);
+        if (nSize + n > nCapacity)
+        {
+            unsigned int nNewCapacity = GrowCapacity(nSize + n);
+            T* pNew = (T*)malloc(nNewCapacity * sizeof(T));
+            if (pNew == NULL)
+                throw std::bad_alloc();
+            T* pOld = begin();
+            memcpy(pNew, pOld, nPos * sizeof(T));
+            copy(first, last, pNew + nPos);
+            memcpy(pNew + nPos + n, pOld + nPos, (nSize - nPos) * sizeof(T));
+            if (!IsInline())
+                free(pHeap);
+            pHeap = pNew;
+            nCapacity = nNewCapacity;
+        }
+        else
+        {
+            // Copy to the spare room past the end and rotate it into place
+            T* p = begin();
+            copy(first, last, p + nSize);
+            rotate(p + nPos, p + nSize, p + nSize + n);
+        }
+        nSize += n;
+        return begin() + nPos;
+    }
+
+    iterator erase(iterator pos)
+    {
+        return erase(pos, pos + 1);
+    }
+
+    iterator erase(iterator first, iterator last)
+    {
+        memmove(first, last, (end() - last) * sizeof(T));
+        nSize -= last - first;
+        return first;
+    }
+
+    template<typename InputIterator>
+    void assign(InputIterator first, InputIterator last)
+    {
+        // Safe for a range inside this vector, it's copied down in place
+        nSize = 0;
+        insert(end(), first, last);
+    }
+
+    void swap(CSmallVector& b)
+    {
+        CSmallVector tmp;
+        memcpy(&tmp, this, sizeof(tmp));
+        memcpy(this, &b, sizeof(tmp));
+        memcpy(&b, &tmp, sizeof(tmp));
+        tmp.nCapacity = N;
+    }
+
+    friend bool operator==(const CSmallVector& a, const CSmallVector& b)
+    {
+        return (a.nSize == b.nSize && equal(a.begin(), a.end(), b.begin()));
+    }
+
+    friend bool operator!=(const CSmallVector& a, const CSmallVector& b)
+    {
+        return !(a == b);
+    }
+
+    friend bool operator<(const CSmallVector& a, const CSmallVector& b)
+    {
+        return lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+    }
+
+    friend bool operator>(const CSmallVector& a, const CSmallVector& b)  { return b < a; }
+    friend bool operator<=(const CSmallVector& a, const CSmallVector& b) { return !(b < a); }
+    friend bool operator>=(const CSmallVector& a, const CSmallVector& b) { return !(a < b); }
+};
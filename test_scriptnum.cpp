@@ -0,0 +1,369 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Script number conformance check.  Runs the int64 fast paths in scriptnum.h
+// against the CBigNum code EvalScript used before them, on edge cases and on
+// random operands, and stops at the first difference:
+//
+//   test_scriptnum [iterations]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <openssl/bn.h>
+#include <boost/foreach.hpp>
+#include <boost/type_traits.hpp>
+using namespace std;
+using namespace boost;
+#define foreach BOOST_FOREACH
+
+// Just enough of util.h for script.h
+#if defined(_MSC_VER) || defined(__BORLANDC__)
+typedef __int64  int64;
+typedef unsigned __int64  uint64;
+#else
+typedef long long  int64;
+typedef unsigned long long  uint64;
+#endif
+
+template<typename T>
+string HexStr(const T itbegin, const T itend, bool fSpaces=true)
+{
+    string str;
+    for (T it = itbegin; it < itend; ++it)
+    {
+        char psz[4];
+        sprintf(psz, "%s%02x", (fSpaces && it != itbegin ? " " : ""), (unsigned char)*it);
+        str += psz;
+    }
+    return str;
+}
+
+// Declared for script.h, the numeric code never calls them
+string strprintf(const char* format, ...);
+template<typename T> string HexNumStr(const T itbegin, const T itend, bool f0x=true);
+class CHashWriter { };
+
+#include "serialize.h"
+#include "uint256.h"
+#include "smallvector.h"
+#include "bignum.h"
+#include "script.h"
+#include "scriptnum.h"
+
+typedef vector<unsigned char> valtype;
+static const CBigNum bnZero(0);
+static const CBigNum bnOne(1);
+static const int64 nMulLimit = (int64)1 << 31;
+
+static const opcodetype opUnary[] = { OP_1ADD, OP_1SUB, OP_2MUL, OP_2DIV, OP_NEGATE, OP_ABS, OP_NOT, OP_0NOTEQUAL };
+static const opcodetype opBinary[] = { OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_LSHIFT, OP_RSHIFT,
+                                       OP_BOOLAND, OP_BOOLOR, OP_NUMEQUAL, OP_NUMEQUALVERIFY, OP_NUMNOTEQUAL,
+                                       OP_LESSTHAN, OP_GREATERTHAN, OP_LESSTHANOREQUAL, OP_GREATERTHANOREQUAL,
+                                       OP_MIN, OP_MAX };
+int nFast = 0;
+
+
+
+// The CBigNum code, as EvalScript had it before the fast paths
+bool CastToBoolOld(const valtype& vch)
+{
+    return (CBigNum(vch) != bnZero);
+}
+
+int ScriptNumToIntOld(const valtype& vch)
+{
+    return CBigNum(vch).getint();
+}
+
+valtype EvalUnaryOld(opcodetype opcode, const valtype& vch)
+{
+    CBigNum bn(vch);
+    switch (opcode)
+    {
+    case OP_1ADD:       bn += bnOne; break;
+    case OP_1SUB:       bn -= bnOne; break;
+    case OP_2MUL:       bn <<= 1; break;
+    case OP_2DIV:       bn >>= 1; break;
+    case OP_NEGATE:     bn = -bn; break;
+    case OP_ABS:        if (bn < bnZero) bn = -bn; break;
+    case OP_NOT:        bn = (bn == bnZero); break;
+    case OP_0NOTEQUAL:  bn = (bn != bnZero); break;
+    }
+    return bn.getvch();
+}
+
+bool EvalBinaryOld(opcodetype opcode, const valtype& vch1, const valtype& vch2, valtype& vchRet)
+{
+    CAutoBN_CTX pctx;
+    CBigNum bn1(vch1);
+    CBigNum bn2(vch2);
+    CBigNum bn;
+    switch (opcode)
+    {
+    case OP_ADD:
+        bn = bn1 + bn2;
+        break;
+
+    case OP_SUB:
+        bn = bn1 - bn2;
+        break;
+
+    case OP_MUL:
+        if (!BN_mul(&bn, &bn1, &bn2, pctx))
+            return false;
+        break;
+
+    case OP_DIV:
+        if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
+            return false;
+        break;
+
+    case OP_MOD:
+        if (!BN_mod(&bn, &bn1, &bn2, pctx))
+            return false;
+        break;
+
+    case OP_LSHIFT:
+        if (bn2 < bnZero)
+            return false;
+        bn = bn1 << bn2.getulong();
+        break;
+
+    case OP_RSHIFT:
+        if (bn2 < bnZero)
+            return false;
+        bn = bn1 >> bn2.getulong();
+        break;
+
+    case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
+    case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
+    case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
+    case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
+    case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
+    case OP_LESSTHAN:            bn = (bn1 < bn2); break;
+    case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
+    case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
+    case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
+    case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
+    case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
+    }
+    vchRet = bn.getvch();
+    return true;
+}
+
+bool WithinOld(const valtype& vch1, const valtype& vch2, const valtype& vch3)
+{
+    CBigNum bn1(vch1);
+    CBigNum bn2(vch2);
+    CBigNum bn3(vch3);
+    return (bn2 <= bn1 && bn1 < bn3);
+}
+
+
+
+string Hex(const valtype& vch)
+{
+    return "[" + HexStr(vch.begin(), vch.end()) + "]";
+}
+
+// Each check runs the operands the way EvalScript does.  Where the fast path
+// declines there's nothing to compare, EvalScript takes the CBigNum code.
+bool CheckNum(const valtype& vch)
+{
+    if (CastToBool(vch) != CastToBoolOld(vch))
+    {
+        printf("CastToBool %s doesn't match CBigNum\n", Hex(vch).c_str());
+        return false;
+    }
+    if (ScriptNumToInt(vch) != ScriptNumToIntOld(vch))
+    {
+        printf("ScriptNumToInt %s doesn't match CBigNum\n", Hex(vch).c_str());
+        return false;
+    }
+    int64 n;
+    if (GetScriptNum(vch, n) && ScriptNumVch(n) != CBigNum(vch).getvch())
+    {
+        printf("GetScriptNum %s doesn't match CBigNum\n", Hex(vch).c_str());
+        return false;
+    }
+    return true;
+}
+
+bool CheckUnary(opcodetype opcode, const valtype& vch)
+{
+    int64 n1, n;
+    if (!GetScriptNum(vch, n1) || !EvalScriptNumUnary(opcode, n1, n))
+        return true;
+    if (ScriptNumVch(n) != EvalUnaryOld(opcode, vch))
+    {
+        printf("%s %s doesn't match CBigNum\n", GetOpName(opcode), Hex(vch).c_str());
+        return false;
+    }
+    nFast++;
+    return true;
+}
+
+bool CheckBinary(opcodetype opcode, const valtype& vch1, const valtype& vch2)
+{
+    int64 n1, n2, n;
+    if (!GetScriptNum(vch1, n1) || !GetScriptNum(vch2, n2) || !EvalScriptNum(opcode, n1, n2, n))
+        return true;
+    valtype vchOld;
+    if (!EvalBinaryOld(opcode, vch1, vch2, vchOld) || ScriptNumVch(n) != vchOld)
+    {
+        printf("%s %s %s doesn't match CBigNum\n", Hex(vch1).c_str(), Hex(vch2).c_str(), GetOpName(opcode));
+        return false;
+    }
+    nFast++;
+    return true;
+}
+
+bool CheckWithin(const valtype& vch1, const valtype& vch2, const valtype& vch3)
+{
+    int64 n1, n2, n3;
+    if (!GetScriptNum(vch1, n1) || !GetScriptNum(vch2, n2) || !GetScriptNum(vch3, n3))
+        return true;
+    if ((n2 <= n1 && n1 < n3) != WithinOld(vch1, vch2, vch3))
+    {
+        printf("%s %s %s OP_WITHIN doesn't match CBigNum\n", Hex(vch1).c_str(), Hex(vch2).c_str(), Hex(vch3).c_str());
+        return false;
+    }
+    nFast++;
+    return true;
+}
+
+bool CheckAll(const valtype& vch1, const valtype& vch2, const valtype& vch3)
+{
+    if (!CheckNum(vch1) || !CheckWithin(vch1, vch2, vch3))
+        return false;
+    for (int i = 0; i < sizeof(opUnary)/sizeof(opUnary[0]); i++)
+        if (!CheckUnary(opUnary[i], vch1))
+            return false;
+    for (int i = 0; i < sizeof(opBinary)/sizeof(opBinary[0]); i++)
+        if (!CheckBinary(opBinary[i], vch1, vch2))
+            return false;
+    return true;
+}
+
+
+
+valtype Bytes(const char* psz)
+{
+    // Little endian hex, as it sits on the stack
+    valtype vch;
+    for (; psz[0] && psz[1]; psz += 2)
+        vch.push_back(strtol(string(psz, psz + 2).c_str(), NULL, 16));
+    return vch;
+}
+
+vector<valtype> EdgeCases()
+{
+    const char* pszCases[] = {
+        "", "00", "80", "0080", "000080", "01", "81", "0100", "0180", "7f", "ff", "ff00", "ff80",
+        "ffffffffffff7f", "ffffffffffffff", "00000000000080", "01000000000000",    // 7 bytes
+        "ffffffffffffff7f", "ffffffffffffffff", "0000000000000080", "0100000000000000",    // 8 bytes
+        "ffffffffffffffffff00",
+    };
+    const int64 nCases[] = {
+        0, 1, -1, 2, 8, 9, 62, 63, 64, -8, -63,    // shift counts
+        nMulLimit - 1, nMulLimit, nMulLimit + 1, -(nMulLimit - 1), -nMulLimit, -(nMulLimit + 1),
+        INT_MAX, (int64)INT_MAX + 1, -(int64)INT_MAX, (int64)INT_MIN, (int64)INT_MIN - 1,
+        ((int64)1 << 32) + 5, ((int64)1 << 55) - 1, -(((int64)1 << 55) - 1),
+    };
+    vector<valtype> vCases;
+    for (int i = 0; i < sizeof(pszCases)/sizeof(pszCases[0]); i++)
+        vCases.push_back(Bytes(pszCases[i]));
+    for (int i = 0; i < sizeof(nCases)/sizeof(nCases[0]); i++)
+        vCases.push_back(CBigNum(nCases[i]).getvch());
+    return vCases;
+}
+
+bool CheckEdgeCases()
+{
+    // The fast path has to take what it's meant to and leave the rest
+    int64 n;
+    if (!GetScriptNum(Bytes("ffffffffffff7f"), n) || GetScriptNum(Bytes("0100000000000000"), n) ||
+        GetScriptNum(Bytes("80"), n) || GetScriptNum(Bytes("0080"), n))
+    {
+        printf("GetScriptNum takes the wrong operand sizes\n");
+        return false;
+    }
+    if (!EvalScriptNum(OP_MUL, nMulLimit - 1, -(nMulLimit - 1), n) || EvalScriptNum(OP_MUL, nMulLimit, 1, n) ||
+        EvalScriptNum(OP_MUL, 1, -nMulLimit, n))
+    {
+        printf("EvalScriptNum OP_MUL limit is wrong\n");
+        return false;
+    }
+    if (!EvalScriptNum(OP_LSHIFT, 1, 0, n) || !EvalScriptNum(OP_LSHIFT, -1, 8, n) || EvalScriptNum(OP_LSHIFT, 1, 9, n) ||
+        EvalScriptNum(OP_LSHIFT, 1, -1, n) || !EvalScriptNum(OP_RSHIFT, -1, 62, n) || !EvalScriptNum(OP_RSHIFT, -1, 63, n) ||
+        EvalScriptNum(OP_RSHIFT, 1, -1, n) || !EvalScriptNum(OP_RSHIFT, 1, INT_MAX, n) ||
+        EvalScriptNum(OP_RSHIFT, 1, (int64)INT_MAX + 1, n))
+    {
+        printf("EvalScriptNum shift limits are wrong\n");
+        return false;
+    }
+    if (ScriptNumToInt(Bytes("ffffffffffff7f")) != INT_MAX || ScriptNumToInt(Bytes("ffffffffffffff")) != INT_MIN ||
+        CastToBool(Bytes("0080")) || CastToBool(Bytes("80")) || !CastToBool(Bytes("0180")))
+    {
+        printf("ScriptNumToInt or CastToBool edge case is wrong\n");
+        return false;
+    }
+
+    // Every combination against CBigNum
+    vector<valtype> vCases = EdgeCases();
+    for (int i = 0; i < vCases.size(); i++)
+        for (int j = 0; j < vCases.size(); j++)
+            if (!CheckAll(vCases[i], vCases[j], vCases[(i + j) % vCases.size()]) ||
+                !CheckWithin(vCases[j], vCases[i], vCases[(i * 7 + j) % vCases.size()]))
+                return false;
+    return true;
+}
+
+valtype RandNum()
+{
+    // Mostly random bytes, which covers non-minimal encodings and negative
+    // zero, plus small shift counts and values around the OP_MUL limit
+    switch (rand() % 4)
+    {
+    case 0:
+        return CBigNum(rand() % 70 - 4).getvch();
+    case 1:
+        return CBigNum((rand() % 2 ? 1 : -1) * (nMulLimit + rand() % 9 - 4)).getvch();
+    default:
+    {
+        valtype vch(rand() % 10);
+        for (int i = 0; i < vch.size(); i++)
+            vch[i] = rand();
+        if (!vch.empty() && rand() % 4 == 0)
+            vch.back() &= 0x80;
+        return vch;
+    }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int nCount = (argc >= 2 ? atoi(argv[1]) : 100000);
+    if (nCount <= 0)
+        nCount = 100000;
+
+    if (!CheckEdgeCases())
+        return 1;
+    for (int i = 0; i < nCount; i++)
+        if (!CheckAll(RandNum(), RandNum(), RandNum()))
+            return 1;
+
+    printf("scriptnum.h matches CBigNum, %d fast path results checked\n", nFast);
+    return 0;
+}
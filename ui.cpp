@@ -348,6 +348,7 @@ void Shutdown(void* parg)
     {
         fShutdown = true;
         nTransactionsUpdated++;
+        AbandonMinerWork(true);
         DBFlush(false);
         StopNode();
         DBFlush(true);
@@ -463,7 +464,7 @@ void CMainFrame::InsertTransaction(const CWalletTx& wtx, bool fNew, int nIndex)
 
     // Find the block the tx is in
     CBlockIndex* pindex = NULL;
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    CHashMap<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
     if (mi != mapBlockIndex.end())
         pindex = (*mi).second;
 
@@ -660,7 +661,7 @@ void CMainFrame::RefreshStatus()
         for (int nIndex = nStart; nIndex < nEnd; nIndex++)
         {
             uint256 hash((string)GetItemText(m_listCtrl, nIndex, 1));
-            map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+            CHashMap<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
             if (mi == mapWallet.end())
             {
                 printf("CMainFrame::RefreshStatus() : tx not found in mapWallet\n");
@@ -697,7 +698,7 @@ void CMainFrame::OnIdle(wxIdleEvent& event)
 
             // Do the newest transactions first
             vSorted.reserve(mapWallet.size());
-            for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            for (CHashMap<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
             {
                 const CWalletTx& wtx = (*it).second;
                 unsigned int nTime = UINT_MAX - wtx.GetTxTime();
@@ -720,7 +721,7 @@ void CMainFrame::OnIdle(wxIdleEvent& event)
             {
                 fEntered = true;
                 uint256& hash = vSorted[i++].second;
-                map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+                CHashMap<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
                 if (mi != mapWallet.end())
                     InsertTransaction((*mi).second, true);
             }
@@ -739,7 +740,7 @@ void CMainFrame::OnIdle(wxIdleEvent& event)
             TRY_CRITICAL_BLOCK(cs_mapWallet)
             {
                 nLastTime = GetTime();
-                for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+                for (CHashMap<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
                 {
                     CWalletTx& wtx = (*it).second;
                     if (wtx.nTimeDisplayed && wtx.nTimeDisplayed != wtx.GetTxTime())
@@ -766,7 +767,7 @@ void CMainFrame::OnPaintListCtrl(wxPaintEvent& event)
             foreach(item, vWalletUpdated)
             {
                 bool fNew = item.second;
-                map<uint256, CWalletTx>::iterator mi = mapWallet.find(item.first);
+                CHashMap<uint256, CWalletTx>::iterator mi = mapWallet.find(item.first);
                 if (mi != mapWallet.end())
                 {
                     printf("vWalletUpdated: %s %s\n", (*mi).second.GetHash().ToString().substr(0,6).c_str(), fNew ? "new" : "");
@@ -840,6 +841,7 @@ void CMainFrame::OnMenuOptionsGenerate(wxCommandEvent& event)
 {
     fGenerateBitcoins = event.IsChecked();
     nTransactionsUpdated++;
+    AbandonMinerWork(true);
     CWalletDB().WriteSetting("fGenerateBitcoins", fGenerateBitcoins);
 
     if (fGenerateBitcoins)
@@ -944,7 +946,7 @@ void CMainFrame::OnListItemActivatedAllTransactions(wxListEvent& event)
     CWalletTx wtx;
     CRITICAL_BLOCK(cs_mapWallet)
     {
-        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        CHashMap<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
         if (mi == mapWallet.end())
         {
             printf("CMainFrame::OnListItemActivatedAllTransactions() : tx not found in mapWallet\n");
@@ -1188,7 +1190,7 @@ CTxDetailsDialog::CTxDetailsDialog(wxWindow* parent, CWalletTx wtx) : CTxDetails
             foreach(const CTxIn& txin, wtx.vin)
             {
                 COutPoint prevout = txin.prevout;
-                map<uint256, CWalletTx>::iterator mi = mapWallet.find(prevout.hash);
+                CHashMap<uint256, CWalletTx>::iterator mi = mapWallet.find(prevout.hash);
                 if (mi != mapWallet.end())
                 {
                     const CWalletTx& prev = (*mi).second;
@@ -2949,6 +2951,7 @@ bool CMyApp::OnInit2()
     //// debug print
     printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     printf("Bitcoin version %d, Windows version %08x\n", VERSION, GetVersion());
+    printf("SHA-256 %s\n", CryptoPP::SHA256_Implementation());
 
     //
     // Limit to single instance per user
@@ -3082,6 +3085,21 @@ bool CMyApp::OnInit2()
             fGenerateBitcoins = atoi(mapArgs["/gen"].c_str());
     }
 
+    if (mapArgs.count("/minerthreads"))
+        nMinerThreads = atoi(mapArgs["/minerthreads"]);
+
+    if (mapArgs.count("/minerstats"))
+        nMinerStatsInterval = max(1, atoi(mapArgs["/minerstats"]));
+
+    if (mapArgs.count("/sigcachesize"))
+        nSigCacheSize = max(1, atoi(mapArgs["/sigcachesize"]));
+
+    if (mapArgs.count("/keycachesize"))
+        nKeyCacheSize = max(1, atoi(mapArgs["/keycachesize"]));
+
+    if (mapArgs.count("/par"))
+        nScriptCheckPar = max(1, atoi(mapArgs["/par"]));
+
     //
     // Create the main frame window
     //
@@ -3102,6 +3120,15 @@ bool CMyApp::OnInit2()
             if (_beginthread(ThreadBitcoinMiner, 0, NULL) == -1)
                 printf("Error: _beginthread(ThreadBitcoinMiner) failed\n");
 
+        if (mapArgs.count("/workserver"))
+        {
+            int nPort = DEFAULT_WORKSERVER_PORT;
+            if (!mapArgs["/workserver"].empty())
+                nPort = atoi(mapArgs["/workserver"]);
+            if (_beginthread(ThreadWorkServer, 0, new int(nPort)) == -1)
+                printf("Error: _beginthread(ThreadWorkServer) failed\n");
+        }
+
         //
         // Tests
         //
@@ -354,6 +354,13 @@ int GetFilesize(FILE* file)
     return nFilesize;
 }
 
+int GetNumCores()
+{
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    return max((int)sysinfo.dwNumberOfProcessors, 1);
+}
+
 
 
 
@@ -378,6 +385,80 @@ uint64 GetRand(uint64 nMax)
 
 
 
+//
+// Pool for CDataStream buffers.  Every message received, relayed or read
+// from disk goes through a few stream buffers of similar sizes, so freed
+// blocks are kept on a free list per power of two size class and handed
+// out again.  Each class keeps up to 1MB or two blocks, anything over 1MB
+// goes straight back to the heap.
+//
+// Streams are used during static initialization, the global nodeLocalHost
+// pushes a version message, so nothing here may depend on link order.  The
+// free lists are plain data linked through the blocks themselves, and the
+// lock is made on first use and never deleted so frees at exit still work.
+//
+static const unsigned int STREAM_BUFFER_MIN_SHIFT = 6;
+static const unsigned int STREAM_BUFFER_CLASSES = 15;
+static const size_t STREAM_BUFFER_CLASS_MAX = 1 << 20;
+static void* pStreamBufferFree[STREAM_BUFFER_CLASSES];
+static size_t nStreamBufferFree[STREAM_BUFFER_CLASSES];
+
+static CCriticalSection& StreamBufferLock()
+{
+    static CCriticalSection* pcs = new CCriticalSection();
+    return *pcs;
+}
+
+static unsigned int StreamBufferClass(size_t nSize)
+{
+    unsigned int nClass = 0;
+    while (nClass < STREAM_BUFFER_CLASSES && ((size_t)1 << (nClass + STREAM_BUFFER_MIN_SHIFT)) < nSize)
+        nClass++;
+    return nClass;
+}
+
+void* StreamBufferAlloc(size_t nSize)
+{
+    unsigned int nClass = StreamBufferClass(nSize);
+    if (nClass == STREAM_BUFFER_CLASSES)
+        return ::operator new(nSize);
+    CCriticalSection& cs_StreamBuffer = StreamBufferLock();
+    CRITICAL_BLOCK(cs_StreamBuffer)
+    {
+        void* p = pStreamBufferFree[nClass];
+        if (p != NULL)
+        {
+            pStreamBufferFree[nClass] = *(void**)p;
+            nStreamBufferFree[nClass]--;
+            return p;
+        }
+    }
+    return ::operator new((size_t)1 << (nClass + STREAM_BUFFER_MIN_SHIFT));
+}
+
+void StreamBufferFree(void* p, size_t nSize)
+{
+    unsigned int nClass = StreamBufferClass(nSize);
+    if (nClass < STREAM_BUFFER_CLASSES)
+    {
+        size_t nClassSize = (size_t)1 << (nClass + STREAM_BUFFER_MIN_SHIFT);
+        CCriticalSection& cs_StreamBuffer = StreamBufferLock();
+        CRITICAL_BLOCK(cs_StreamBuffer)
+        {
+            if (nStreamBufferFree[nClass] < 2 || (nStreamBufferFree[nClass] + 1) * nClassSize <= STREAM_BUFFER_CLASS_MAX)
+            {
+                *(void**)p = pStreamBufferFree[nClass];
+                pStreamBufferFree[nClass] = p;
+                nStreamBufferFree[nClass]++;
+                return;
+            }
+        }
+    }
+    ::operator delete(p);
+}
+
+
+
 
 
 
@@ -401,6 +482,17 @@ int64 GetTime()
     return time(NULL);
 }
 
+// Performance counter time for measuring intervals, not related to GetTime
+int64 GetTimeMicros()
+{
+    static int64 nFrequency;
+    if (nFrequency == 0)
+        QueryPerformanceFrequency((LARGE_INTEGER*)&nFrequency);
+    int64 nCounter;
+    QueryPerformanceCounter((LARGE_INTEGER*)&nCounter);
+    return (int64)(nCounter * (1000000.0 / nFrequency));
+}
+
 static int64 nTimeOffset = 0;
 
 int64 GetAdjustedTime()
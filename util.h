@@ -78,8 +78,10 @@ string FormatMoney(int64 n, bool fPlus=false);
 bool ParseMoney(const char* pszIn, int64& nRet);
 bool FileExists(const char* psz);
 int GetFilesize(FILE* file);
+int GetNumCores();
 uint64 GetRand(uint64 nMax);
 int64 GetTime();
+int64 GetTimeMicros();
 int64 GetAdjustedTime();
 void AddTimeData(unsigned int ip, int64 nTime);
 
@@ -339,9 +341,9 @@ template<typename T1>
 inline uint256 Hash(const T1 pbegin, const T1 pend)
 {
     uint256 hash1;
-    SHA256((unsigned char*)&pbegin[0], (pend - pbegin) * sizeof(pbegin[0]), (unsigned char*)&hash1);
+    CryptoPP::SHA256_Hash((unsigned char*)&hash1, (unsigned char*)&pbegin[0], (pend - pbegin) * sizeof(pbegin[0]));
     uint256 hash2;
-    SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+    CryptoPP::SHA256_Hash((unsigned char*)&hash2, (unsigned char*)&hash1, sizeof(hash1));
     return hash2;
 }
 
@@ -350,13 +352,12 @@ inline uint256 Hash(const T1 p1begin, const T1 p1end,
                     const T2 p2begin, const T2 p2end)
 {
     uint256 hash1;
-    SHA256_CTX ctx;
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, (unsigned char*)&p1begin[0], (p1end - p1begin) * sizeof(p1begin[0]));
-    SHA256_Update(&ctx, (unsigned char*)&p2begin[0], (p2end - p2begin) * sizeof(p2begin[0]));
-    SHA256_Final((unsigned char*)&hash1, &ctx);
+    CryptoPP::SHA256Context ctx;
+    ctx.Update((unsigned char*)&p1begin[0], (p1end - p1begin) * sizeof(p1begin[0]));
+    ctx.Update((unsigned char*)&p2begin[0], (p2end - p2begin) * sizeof(p2begin[0]));
+    ctx.Final((unsigned char*)&hash1);
     uint256 hash2;
-    SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+    CryptoPP::SHA256_Hash((unsigned char*)&hash2, (unsigned char*)&hash1, sizeof(hash1));
     return hash2;
 }
 
@@ -366,33 +367,69 @@ inline uint256 Hash(const T1 p1begin, const T1 p1end,
                     const T3 p3begin, const T3 p3end)
 {
     uint256 hash1;
-    SHA256_CTX ctx;
-    SHA256_Init(&ctx);
-    SHA256_Update(&ctx, (unsigned char*)&p1begin[0], (p1end - p1begin) * sizeof(p1begin[0]));
-    SHA256_Update(&ctx, (unsigned char*)&p2begin[0], (p2end - p2begin) * sizeof(p2begin[0]));
-    SHA256_Update(&ctx, (unsigned char*)&p3begin[0], (p3end - p3begin) * sizeof(p3begin[0]));
-    SHA256_Final((unsigned char*)&hash1, &ctx);
+    CryptoPP::SHA256Context ctx;
+    ctx.Update((unsigned char*)&p1begin[0], (p1end - p1begin) * sizeof(p1begin[0]));
+    ctx.Update((unsigned char*)&p2begin[0], (p2end - p2begin) * sizeof(p2begin[0]));
+    ctx.Update((unsigned char*)&p3begin[0], (p3end - p3begin) * sizeof(p3begin[0]));
+    ctx.Final((unsigned char*)&hash1);
     uint256 hash2;
-    SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+    CryptoPP::SHA256_Hash((unsigned char*)&hash2, (unsigned char*)&hash1, sizeof(hash1));
     return hash2;
 }
 
+//
+// Write-only stream that feeds everything serialized to it straight into
+// SHA-256, so hashing an object doesn't need a CDataStream buffer
+//
+class CHashWriter
+{
+private:
+    CryptoPP::SHA256Context ctx;
+
+public:
+    int nType;
+    int nVersion;
+
+    CHashWriter(int nTypeIn, int nVersionIn=VERSION) : nType(nTypeIn), nVersion(nVersionIn) {}
+
+    CHashWriter& write(const char* pch, int nSize)
+    {
+        assert(nSize >= 0);
+        ctx.Update(pch, nSize);
+        return (*this);
+    }
+
+    // Double SHA-256 of everything written, only call once
+    uint256 GetHash()
+    {
+        uint256 hash1;
+        ctx.Final((unsigned char*)&hash1);
+        uint256 hash2;
+        CryptoPP::SHA256_Hash((unsigned char*)&hash2, (unsigned char*)&hash1, sizeof(hash1));
+        return hash2;
+    }
+
+    template<typename T>
+    CHashWriter& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=VERSION)
 {
-    // Most of the time is spent allocating and deallocating CDataStream's
-    // buffer.  If this ever needs to be optimized further, make a CStaticStream
-    // class with its buffer on the stack.
-    CDataStream ss(nType, nVersion);
-    ss.reserve(10000);
+    CHashWriter ss(nType, nVersion);
     ss << obj;
-    return Hash(ss.begin(), ss.end());
+    return ss.GetHash();
 }
 
 inline uint160 Hash160(const vector<unsigned char>& vch)
 {
     uint256 hash1;
-    SHA256(&vch[0], vch.size(), (unsigned char*)&hash1);
+    CryptoPP::SHA256_Hash((unsigned char*)&hash1, &vch[0], vch.size());
     uint160 hash2;
     RIPEMD160((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
     return hash2;
@@ -0,0 +1,360 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+#include "headers.h"
+
+bool fWorkServer = false;
+
+static const unsigned int MAX_WORK_MESSAGE = 0x100000;
+static const unsigned int MAX_WORK_SEND = 0x100000;
+static const int MAX_WORK_JOBS = 256;
+
+
+
+
+class CWorkJob
+{
+public:
+    CBlock block;
+    CBlockIndex* pindexPrev;
+    vector<unsigned char> vchCoinbase1;
+    vector<unsigned char> vchCoinbase2;
+    vector<uint256> vMerkleBranch;
+    CKey key;
+};
+
+class CWorkClient
+{
+public:
+    SOCKET hSocket;
+    CDataStream vRecv;
+    CDataStream vSend;
+    bool fWantWork;
+    bool fDisconnect;
+
+    CWorkClient(SOCKET hSocketIn) : vRecv(SER_NETWORK), vSend(SER_NETWORK)
+    {
+        hSocket = hSocketIn;
+        fWantWork = false;
+        fDisconnect = false;
+    }
+};
+
+static map<unsigned int, CWorkJob> mapWorkJobs;
+static unsigned int nWorkJobNext = 1;
+
+
+
+
+// Only queues the message, the select loop sends it when the socket is
+// writable.  A worker that stops reading gets dropped once too much is
+// waiting, it never holds up the others.
+bool SendWorkMessage(CWorkClient* pclient, char chCommand, const CDataStream& ss)
+{
+    CDataStream& vSend = pclient->vSend;
+    if (vSend.size() + 5 + ss.size() > MAX_WORK_SEND)
+    {
+        printf("work server: worker isn't reading, dropping it\n");
+        pclient->fDisconnect = true;
+        return false;
+    }
+    unsigned int nSize = ss.size();
+    vSend.write((char*)&nSize, 4);
+    vSend.write(&chCommand, 1);
+    vSend.insert(vSend.end(), ss.begin(), ss.end());
+    return true;
+}
+
+bool SendWork(CWorkClient* pclient)
+{
+    unsigned int nJob = nWorkJobNext++;
+    CWorkJob& job = mapWorkJobs[nJob];
+    while (mapWorkJobs.size() > MAX_WORK_JOBS)
+        mapWorkJobs.erase(mapWorkJobs.begin());
+
+    unsigned int nBits;
+    int64 nFees;
+    unsigned int nTransactionsUpdatedLast;
+    int64 nTemplateTime;
+    if (!GetMinerTemplate(job.block, job.vMerkleBranch, job.pindexPrev, nBits, nFees, nTransactionsUpdatedLast, nTemplateTime) || !job.pindexPrev)
+    {
+        mapWorkJobs.erase(nJob);
+        return error("SendWork() : GetMinerTemplate failed");
+    }
+    job.key.MakeNewKey();
+
+    CTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vin[0].scriptSig << nBits << vector<unsigned char>(8, 0);
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey << job.key.GetPubKey() << OP_CHECKSIG;
+    txNew.vout[0].nValue = job.block.GetBlockValue(nFees);
+
+    job.block.vtx[0] = txNew;
+    job.block.hashPrevBlock = job.pindexPrev->GetBlockHash();
+    job.block.nTime = max(job.pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
+    job.block.nBits = nBits;
+    job.block.nNonce = 0;
+
+    // The extranonce is the last 8 bytes of the scriptSig.  The first 4 are
+    // the job number so no two jobs overlap, the worker rolls the other 4.
+    CDataStream ssTx(SER_NETWORK);
+    ssTx << txNew;
+    const CScript& scriptSig = txNew.vin[0].scriptSig;
+    unsigned int nPos = 4 + 1 + 36 + GetSizeOfCompactSize(scriptSig.size()) + scriptSig.size() - 8;
+    memcpy(&ssTx[nPos], &nJob, 4);
+    job.vchCoinbase1.assign(ssTx.begin(), ssTx.begin() + nPos + 4);
+    job.vchCoinbase2.assign(ssTx.begin() + nPos + 8, ssTx.end());
+
+    CDataStream ss(SER_NETWORK);
+    ss << nJob << job.block.nVersion << job.block.hashPrevBlock << job.block.nTime << job.block.nBits;
+    ss << CBigNum().SetCompact(nBits).getuint256();
+    ss << job.vchCoinbase1 << job.vchCoinbase2 << job.vMerkleBranch;
+    pclient->fWantWork = true;
+    return SendWorkMessage(pclient, 'w', ss);
+}
+
+bool SubmitWork(CWorkClient* pclient, CDataStream& vRecv)
+{
+    unsigned int nJob, nExtraNonce2, nTime, nNonce;
+    vRecv >> nJob >> nExtraNonce2 >> nTime >> nNonce;
+
+    bool fAccepted = false;
+    map<unsigned int, CWorkJob>::iterator mi = mapWorkJobs.find(nJob);
+    if (mi == mapWorkJobs.end())
+    {
+        printf("work server: submit for unknown job %u\n", nJob);
+    }
+    else
+    {
+        CWorkJob& job = (*mi).second;
+        vector<unsigned char> vchCoinbase(job.vchCoinbase1);
+        vchCoinbase.insert(vchCoinbase.end(), (unsigned char*)&nExtraNonce2, (unsigned char*)&nExtraNonce2 + 4);
+        vchCoinbase.insert(vchCoinbase.end(), job.vchCoinbase2.begin(), job.vchCoinbase2.end());
+
+        auto_ptr<CBlock> pblock(new CBlock(job.block));
+        CDataStream ssTx(vchCoinbase, SER_NETWORK);
+        ssTx >> pblock->vtx[0];
+        pblock->nTime = nTime;
+        pblock->nNonce = nNonce;
+        pblock->hashMerkleRoot = CBlock::CheckMerkleBranch(pblock->vtx[0].GetHash(), job.vMerkleBranch, 0);
+
+        if (pblock->CheckBlock())
+        {
+            //// debug print
+            printf("work server: proof-of-work found for job %u\n", nJob);
+            pblock->print();
+
+            CRITICAL_BLOCK(cs_main)
+            {
+                if (pblock->hashPrevBlock != hashBestChain)
+                {
+                    printf("work server: job %u is stale\n", nJob);
+                }
+                else if (AddKey(job.key))
+                {
+                    fAccepted = ProcessBlock(NULL, pblock.release());
+                    if (!fAccepted)
+                        printf("ERROR in SubmitWork, ProcessBlock, block not accepted\n");
+                }
+            }
+        }
+    }
+
+    CDataStream ss(SER_NETWORK);
+    ss << nJob << (char)fAccepted;
+    return SendWorkMessage(pclient, 'r', ss);
+}
+
+bool ProcessWorkMessages(CWorkClient* pclient)
+{
+    CDataStream& vRecv = pclient->vRecv;
+    while (vRecv.size() >= 5)
+    {
+        unsigned int nSize;
+        memcpy(&nSize, &vRecv[0], 4);
+        if (nSize > MAX_WORK_MESSAGE)
+            return error("ProcessWorkMessages() : message too big %u", nSize);
+        if (vRecv.size() < 5 + nSize)
+            break;
+        char chCommand = vRecv[4];
+        CDataStream vMsg(vRecv.begin() + 5, vRecv.begin() + 5 + nSize, SER_NETWORK);
+        vRecv.ignore(5 + nSize);
+
+        try
+        {
+            if (chCommand == 'g')
+                SendWork(pclient);
+            else if (chCommand == 's')
+                SubmitWork(pclient, vMsg);
+            else
+                return error("ProcessWorkMessages() : unknown command %d", chCommand);
+        }
+        catch (std::exception& e)
+        {
+            return error("ProcessWorkMessages() : %s", e.what());
+        }
+    }
+    return true;
+}
+
+
+
+
+void ThreadWorkServer2(int nPort)
+{
+    SOCKET hListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (hListenSocket == INVALID_SOCKET)
+    {
+        printf("Error: work server couldn't open socket (socket returned error %d)\n", WSAGetLastError());
+        return;
+    }
+    u_long nOne = 1;
+    if (ioctlsocket(hListenSocket, FIONBIO, &nOne) == SOCKET_ERROR)
+    {
+        printf("Error: work server couldn't set socket nonblocking (ioctlsocket returned error %d)\n", WSAGetLastError());
+        closesocket(hListenSocket);
+        return;
+    }
+
+    // Workers run on this machine, never accept anything from outside
+    struct sockaddr_in sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr.sin_port = htons(nPort);
+    if (bind(hListenSocket, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) == SOCKET_ERROR ||
+        listen(hListenSocket, SOMAXCONN) == SOCKET_ERROR)
+    {
+        printf("Error: work server unable to listen on 127.0.0.1:%d (error %d)\n", nPort, WSAGetLastError());
+        closesocket(hListenSocket);
+        return;
+    }
+    printf("work server listening on 127.0.0.1:%d\n", nPort);
+    fWorkServer = true;
+
+    vector<CWorkClient*> vClients;
+    CBlockIndex* pindexLast = pindexBest;
+    while (!fShutdown)
+    {
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_SET(hListenSocket, &fdsetRecv);
+        SOCKET hSocketMax = hListenSocket;
+        foreach(CWorkClient* pclient, vClients)
+        {
+            FD_SET(pclient->hSocket, &fdsetRecv);
+            if (!pclient->vSend.empty())
+                FD_SET(pclient->hSocket, &fdsetSend);
+            hSocketMax = max(hSocketMax, pclient->hSocket);
+        }
+
+        struct timeval timeout;
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = 250000;
+        int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, NULL, &timeout);
+        if (fShutdown)
+            break;
+        if (nSelect == SOCKET_ERROR)
+        {
+            printf("work server select error %d\n", WSAGetLastError());
+            Sleep(250);
+            continue;
+        }
+
+        if (FD_ISSET(hListenSocket, &fdsetRecv))
+        {
+            SOCKET hSocket = accept(hListenSocket, NULL, NULL);
+            if (hSocket != INVALID_SOCKET)
+            {
+                printf("work server: worker connected\n");
+                vClients.push_back(new CWorkClient(hSocket));
+            }
+        }
+
+        foreach(CWorkClient* pclient, vClients)
+        {
+            CDataStream& vSend = pclient->vSend;
+            if (FD_ISSET(pclient->hSocket, &fdsetSend) && !vSend.empty())
+            {
+                int nBytes = send(pclient->hSocket, &vSend[0], vSend.size(), 0);
+                if (nBytes > 0)
+                {
+                    vSend.erase(vSend.begin(), vSend.begin() + nBytes);
+                }
+                else if (nBytes == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK)
+                {
+                    printf("work server send error %d\n", WSAGetLastError());
+                    pclient->fDisconnect = true;
+                }
+            }
+
+            if (!FD_ISSET(pclient->hSocket, &fdsetRecv) || pclient->fDisconnect)
+                continue;
+            CDataStream& vRecv = pclient->vRecv;
+            unsigned int nPos = vRecv.size();
+            vRecv.resize(nPos + 0x10000);
+            int nBytes = recv(pclient->hSocket, &vRecv[nPos], 0x10000, 0);
+            vRecv.resize(nPos + max(nBytes, 0));
+            if (nBytes == 0 || (nBytes == SOCKET_ERROR && WSAGetLastError() != WSAEWOULDBLOCK))
+                pclient->fDisconnect = true;
+            else if (!ProcessWorkMessages(pclient))
+                pclient->fDisconnect = true;
+        }
+
+        // New best block, the old jobs can't make a block anymore.  The new
+        // work is only queued here, a stalled worker doesn't delay the rest.
+        if (pindexBest != pindexLast)
+        {
+            pindexLast = pindexBest;
+            for (map<unsigned int, CWorkJob>::iterator mi = mapWorkJobs.begin(); mi != mapWorkJobs.end();)
+            {
+                if ((*mi).second.pindexPrev != pindexLast)
+                    mapWorkJobs.erase(mi++);
+                else
+                    ++mi;
+            }
+            foreach(CWorkClient* pclient, vClients)
+                if (pclient->fWantWork && !pclient->fDisconnect)
+                    SendWork(pclient);
+        }
+
+        for (int i = vClients.size() - 1; i >= 0; i--)
+        {
+            if (vClients[i]->fDisconnect)
+            {
+                printf("work server: worker disconnected\n");
+                closesocket(vClients[i]->hSocket);
+                delete vClients[i];
+                vClients.erase(vClients.begin() + i);
+            }
+        }
+    }
+
+    fWorkServer = false;
+    foreach(CWorkClient* pclient, vClients)
+    {
+        closesocket(pclient->hSocket);
+        delete pclient;
+    }
+    closesocket(hListenSocket);
+}
+
+void ThreadWorkServer(void* parg)
+{
+    int nPort = *(int*)parg;
+    delete (int*)parg;
+
+    // StopNode waits on this, SubmitWork can still be writing a block
+    vfThreadRunning[4] = true;
+    try
+    {
+        ThreadWorkServer2(nPort);
+    }
+    CATCH_PRINT_EXCEPTION("ThreadWorkServer()")
+    vfThreadRunning[4] = false;
+}
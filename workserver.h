@@ -0,0 +1,32 @@
+// Copyright (c) 2009 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Local work server for miner processes.  Listens on 127.0.0.1 only.
+// Every message in either direction is
+//
+//   unsigned int nSize       size of the payload
+//   char chCommand
+//   payload                  serialized the same as on the p2p network
+//
+// Worker to node:
+//   'g'  getwork, no payload
+//   's'  submit:  unsigned int nJob, nExtraNonce2, nTime, nNonce
+//
+// Node to worker:
+//   'w'  work:    unsigned int nJob, int nVersion, uint256 hashPrevBlock,
+//                 unsigned int nTime, nBits, uint256 hashTarget,
+//                 vector<unsigned char> vchCoinbase1, vchCoinbase2,
+//                 vector<uint256> vMerkleBranch
+//   'r'  result:  unsigned int nJob, char fAccepted
+//
+// The coinbase is vchCoinbase1 + nExtraNonce2 (4 bytes) + vchCoinbase2.  Its
+// hash and vMerkleBranch give the merkle root.  Fresh work is pushed to every
+// worker that has asked for work when the best block changes.
+//
+
+static const int DEFAULT_WORKSERVER_PORT = 8334;
+
+extern bool fWorkServer;
+extern void ThreadWorkServer(void* parg);